@@ -0,0 +1,171 @@
+#include "sine_jobs.h"
+
+// Index of the worker running on this thread, -1 on every other thread
+static thread_local int current_worker = -1;
+
+SineJobSystem& SineJobSystem::get() {
+    static SineJobSystem system;
+    return system;
+}
+
+void SineJobSystem::start(int worker_count) {
+    if(started) return;
+    started = true;
+    stopping = false;
+    main_thread = std::this_thread::get_id();
+
+    if(worker_count < 0) {
+        worker_count = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+    }
+    for(int i = 0; i < worker_count; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for(int i = 0; i < worker_count; i++) {
+        workers[i]->thread = std::thread(&SineJobSystem::workerLoop, this, i);
+    }
+}
+
+void SineJobSystem::shutdown() {
+    if(!started) return;
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto& worker : workers) {
+        if(worker->thread.joinable()) worker->thread.join();
+    }
+    workers.clear();
+    flushMainThread();
+    started = false;
+}
+
+void SineJobSystem::push(std::function<void()> job) {
+    if(workers.empty()) { // No workers (single core), run it right away
+        job();
+        return;
+    }
+
+    // Workers push on their own deque, other threads spread the jobs round robin
+    int index = current_worker >= 0 ? current_worker : (int)(next_worker++ % workers.size());
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->jobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+// Pops a job from this thread's own deque, or steals one from another worker, and runs it
+bool SineJobSystem::tryRunOne() {
+    std::function<void()> job;
+    int count = (int)workers.size();
+
+    if(current_worker >= 0) {
+        Worker& own = *workers[current_worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.jobs.empty()) {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+        }
+    }
+
+    int first = current_worker >= 0 ? current_worker + 1 : (int)(next_worker.load() % std::max(count, 1));
+    for(int i = 0; i < count && !job; i++) {
+        Worker& victim = *workers[(first + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+        }
+    }
+
+    if(!job) return false;
+    queued--;
+    job();
+    return true;
+}
+
+void SineJobSystem::workerLoop(int index) {
+    current_worker = index;
+    while(true) {
+        if(tryRunOne()) continue;
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+        if(stopping && queued.load() == 0) break;
+    }
+    current_worker = -1;
+}
+
+void SineJobSystem::finish(SineJobCounter* counter) {
+    if(!counter) return;
+
+    // The decrement happens under the lock so wait() can't return, and the counter die,
+    // while the last job is still taking the continuations out of it
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        if(counter->count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            ready.swap(counter->continuations);
+        }
+    }
+    for(auto& job : ready) push(std::move(job));
+}
+
+void SineJobSystem::run(std::function<void()> job, SineJobCounter* counter) {
+    if(!started) start();
+    if(counter) counter->count.fetch_add(1, std::memory_order_relaxed);
+    push([this, job = std::move(job), counter]() {
+        job();
+        finish(counter);
+    });
+}
+
+void SineJobSystem::runAfter(SineJobCounter& dependency, std::function<void()> job, SineJobCounter* counter) {
+    if(!started) start();
+    if(counter) counter->count.fetch_add(1, std::memory_order_relaxed);
+    std::function<void()> wrapped = [this, job = std::move(job), counter]() {
+        job();
+        finish(counter);
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(dependency.mutex);
+        if(!dependency.done()) {
+            dependency.continuations.push_back(std::move(wrapped));
+            return;
+        }
+    }
+    push(std::move(wrapped));
+}
+
+void SineJobSystem::wait(SineJobCounter& counter) {
+    while(!counter.done()) {
+        if(isMainThread()) flushMainThread(); // A job could be waiting on the main thread
+        if(!tryRunOne()) std::this_thread::yield();
+    }
+    // The last job may still hold the lock of the counter, don't let it die under it
+    std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+void SineJobSystem::runOnMainThread(std::function<void()> job) {
+    if(isMainThread()) {
+        job();
+        return;
+    }
+    std::lock_guard<std::mutex> lock(main_mutex);
+    main_jobs.push_back(std::move(job));
+}
+
+void SineJobSystem::flushMainThread() {
+    std::vector<std::function<void()>> jobs;
+    {
+        std::lock_guard<std::mutex> lock(main_mutex);
+        jobs.swap(main_jobs);
+    }
+    for(auto& job : jobs) job();
+}
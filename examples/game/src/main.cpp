@@ -33,5 +33,5 @@ int main(){
     }
     
     manager.UnloadStates();
-    CloseWindow();
+    CloseSineWindow(); // Joins the job system workers before the window and GL context go away
 }
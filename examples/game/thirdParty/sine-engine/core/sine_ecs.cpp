@@ -0,0 +1,200 @@
+#include "sine_ecs.h"
+#include <algorithm>
+
+SineEcsArchetype* SineEcsWorld::getArchetype(uint64_t signature) {
+    auto it = archetype_of.find(signature);
+    if(it != archetype_of.end()) return it->second;
+
+    auto archetype = std::make_unique<SineEcsArchetype>();
+    archetype->signature = signature;
+    std::fill(std::begin(archetype->column_of), std::end(archetype->column_of), -1);
+    for(int id = 0; id < SINE_ECS_MAX_COMPONENTS; id++) {
+        if(signature & (uint64_t(1) << id)) {
+            archetype->column_of[id] = (int)archetype->components.size();
+            archetype->components.push_back(id);
+        }
+    }
+
+    // As many entities as fit in a chunk, with every column aligned for its type
+    const auto& infos = SineEcsComponents();
+    size_t row_bytes = sizeof(SineEcsId);
+    for(int id : archetype->components) row_bytes += infos[id].size;
+    archetype->capacity = (int)std::max<size_t>(SineEcsArchetype::CHUNK_BYTES / row_bytes, 1);
+    while(true) {
+        size_t offset = sizeof(SineEcsId) * archetype->capacity;
+        archetype->offsets.clear();
+        for(int id : archetype->components) {
+            offset = (offset + infos[id].align - 1) / infos[id].align * infos[id].align;
+            archetype->offsets.push_back(offset);
+            offset += infos[id].size * archetype->capacity;
+        }
+        if(offset <= SineEcsArchetype::CHUNK_BYTES || archetype->capacity == 1) break;
+        archetype->capacity--; // The padding didn't fit
+    }
+
+    SineEcsArchetype* result = archetype.get();
+    archetypes.push_back(std::move(archetype));
+    archetype_of[signature] = result;
+    return result;
+}
+
+SineEcsArchetype* SineEcsWorld::addEdge(SineEcsArchetype* from, int component) {
+    auto it = from->add_edges.find(component);
+    if(it != from->add_edges.end()) return it->second;
+    SineEcsArchetype* to = getArchetype(from->signature | (uint64_t(1) << component));
+    from->add_edges[component] = to;
+    return to;
+}
+
+SineEcsArchetype* SineEcsWorld::removeEdge(SineEcsArchetype* from, int component) {
+    auto it = from->remove_edges.find(component);
+    if(it != from->remove_edges.end()) return it->second;
+    SineEcsArchetype* to = getArchetype(from->signature & ~(uint64_t(1) << component));
+    from->remove_edges[component] = to;
+    return to;
+}
+
+SineEcsId SineEcsWorld::newId() {
+    uint32_t index;
+    if(!free_ids.empty()) {
+        index = free_ids.back();
+        free_ids.pop_back();
+    }
+    else {
+        index = (uint32_t)records.size();
+        records.push_back(Record{});
+    }
+    return SineEcsId{index, records[index].generation};
+}
+
+void SineEcsWorld::allocateRow(SineEcsArchetype* archetype, SineEcsId id) {
+    if(archetype->chunks.empty() || archetype->chunks.back().count == archetype->capacity) {
+        SineEcsChunk chunk;
+        chunk.data = static_cast<std::byte*>(::operator new(SineEcsArchetype::CHUNK_BYTES, std::align_val_t(64)));
+        archetype->chunks.push_back(chunk);
+    }
+    SineEcsChunk& chunk = archetype->chunks.back();
+    int row = chunk.count++;
+    archetype->ids(chunk)[row] = id;
+    archetype->count++;
+
+    Record& record = records[id.index];
+    record.archetype = archetype;
+    record.chunk = (int)archetype->chunks.size() - 1;
+    record.row = row;
+}
+
+void SineEcsWorld::removeRow(SineEcsId id, bool destroy_components) {
+    Record& record = records[id.index];
+    SineEcsArchetype* archetype = record.archetype;
+    SineEcsChunk& chunk = archetype->chunks[record.chunk];
+    SineEcsChunk& last_chunk = archetype->chunks.back();
+    int last_row = last_chunk.count - 1;
+    const auto& infos = SineEcsComponents();
+
+    for(int column = 0; column < (int)archetype->components.size(); column++) {
+        const SineEcsComponentInfo& info = infos[archetype->components[column]];
+        void* hole = archetype->component(chunk, column, record.row);
+        if(destroy_components) info.destroy(hole);
+        if(&chunk != &last_chunk || record.row != last_row) {
+            void* last = archetype->component(last_chunk, column, last_row);
+            info.move(hole, last);
+            info.destroy(last);
+        }
+    }
+
+    // The last entity takes the freed row
+    if(&chunk != &last_chunk || record.row != last_row) {
+        SineEcsId moved = archetype->ids(last_chunk)[last_row];
+        archetype->ids(chunk)[record.row] = moved;
+        records[moved.index].chunk = record.chunk;
+        records[moved.index].row = record.row;
+    }
+
+    last_chunk.count--;
+    archetype->count--;
+    // Free the last chunk once empty, the rows always end in it. The first one stays for reuse.
+    if(last_chunk.count == 0 && archetype->chunks.size() > 1) {
+        ::operator delete(last_chunk.data, std::align_val_t(64));
+        archetype->chunks.pop_back();
+    }
+    record.archetype = nullptr;
+}
+
+void SineEcsWorld::moveEntity(SineEcsId id, SineEcsArchetype* target) {
+    Record old = records[id.index];
+    SineEcsArchetype* source = old.archetype;
+    SineEcsChunk& source_chunk = source->chunks[old.chunk];
+    const auto& infos = SineEcsComponents();
+
+    allocateRow(target, id);
+    const Record& record = records[id.index];
+    SineEcsChunk& target_chunk = target->chunks[record.chunk];
+    for(int column = 0; column < (int)source->components.size(); column++) {
+        int component = source->components[column];
+        void* from = source->component(source_chunk, column, old.row);
+        int target_column = target->column_of[component];
+        if(target_column >= 0) infos[component].move(target->component(target_chunk, target_column, record.row), from);
+        infos[component].destroy(from);
+    }
+
+    // Take the old row out, its components are gone already
+    Record moved_to = records[id.index];
+    records[id.index] = old;
+    removeRow(id, false);
+    records[id.index] = moved_to;
+}
+
+void SineEcsWorld::destroy(SineEcsId id) {
+    if(!alive(id)) return;
+    if(iterating) {
+        destroyLater(id);
+        return;
+    }
+    Record& record = records[id.index];
+    if(record.pending) record.pending = false; // Never got a row, its create is skipped at flush()
+    else removeRow(id, true);
+    if(++record.generation == 0) record.generation = 1;
+    free_ids.push_back(id.index);
+}
+
+void SineEcsWorld::destroyLater(SineEcsId id) {
+    defer([id](SineEcsWorld& world) { world.destroy(id); });
+}
+
+void SineEcsWorld::flush() {
+    if(iterating) return;
+    std::vector<std::unique_ptr<PendingOp>> ops;
+    ops.swap(pending);
+    for(auto& op : ops) op->apply(*this);
+}
+
+void SineEcsWorld::clear() {
+    const auto& infos = SineEcsComponents();
+    for(auto& archetype : archetypes) {
+        for(auto& chunk : archetype->chunks) {
+            for(int column = 0; column < (int)archetype->components.size(); column++) {
+                const SineEcsComponentInfo& info = infos[archetype->components[column]];
+                for(int row = 0; row < chunk.count; row++) info.destroy(archetype->component(chunk, column, row));
+            }
+            chunk.count = 0;
+        }
+        archetype->count = 0;
+    }
+    pending.clear();
+    for(uint32_t i = 0; i < records.size(); i++) {
+        if(records[i].archetype || records[i].pending) {
+            records[i].archetype = nullptr;
+            records[i].pending = false;
+            if(++records[i].generation == 0) records[i].generation = 1;
+            free_ids.push_back(i);
+        }
+    }
+}
+
+SineEcsWorld::~SineEcsWorld() {
+    clear();
+    for(auto& archetype : archetypes) {
+        for(auto& chunk : archetype->chunks) ::operator delete(chunk.data, std::align_val_t(64));
+    }
+}
@@ -10,9 +10,19 @@
 #include <algorithm>
 #include <unordered_map>
 #include <utility>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <cstddef>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SINE_SSE2
+#include <emmintrin.h>
+#endif
 #include <LDtkLoader/Project.hpp>
 #include "raylib.h"
 #include "raymath.h"
+#include "sine_jobs.h"
+#include "sine_ecs.h"
 
 inline int gameWidth = 640, gameHeight = 360;
 
@@ -27,18 +37,1310 @@ inline void InitSineWindow(int screenW, int screenH, int gameW, int gameH, const
     SetTargetFPS(fps);
 }
 
-// Stupid std::pair<float, float> hash function because C++ is too stupid to process anything...
-struct FloatPairHash {
-    std::size_t operator()(const std::pair<float, float>& p) const {
-        std::size_t h1 = std::hash<float>{}(p.first);
-        std::size_t h2 = std::hash<float>{}(p.second);
-        // Combine hashes (e.g., using boost-style hash combine)
-        return h1 ^ (h2 << 1);
+// Stops the job system, then closes the window. Use it instead of CloseWindow().
+inline void CloseSineWindow() {
+    SineJobSystem::get().shutdown();
+    CloseWindow();
+}
+
+class SineBasic;
+
+// Monotonic allocator: hands out memory from big blocks by bumping an offset and frees everything at once in release().
+// Each SineState owns one, so a whole level goes away in one shot when the state is switched.
+class SineArena
+{
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    // Destructor to run on release() for an object made with create()
+    struct Finalizer {
+        void* object;
+        void (*destroy)(void*);
+    };
+    
+    std::vector<Block> blocks;
+    std::vector<Finalizer> finalizers;
+    size_t offset = 0;      // Used bytes in the last block
+    size_t block_size;
+    std::mutex mutex;       // Parallel group members can spawn
+    
+public:
+    explicit SineArena(size_t block_size = 64 * 1024) : block_size(block_size) {}
+    SineArena(const SineArena&) = delete;
+    SineArena& operator=(const SineArena&) = delete;
+    
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        while(true) {
+            if(!blocks.empty()) {
+                uintptr_t base = (uintptr_t)blocks.back().data.get();
+                size_t start = ((base + offset + align - 1) & ~(uintptr_t)(align - 1)) - base;
+                if(start + size <= blocks.back().size) {
+                    offset = start + size;
+                    return blocks.back().data.get() + start;
+                }
+            }
+            // Doesn't fit, start a new block (a bigger one for big allocations)
+            size_t size_needed = std::max(block_size, size + align);
+            blocks.push_back(Block{std::unique_ptr<char[]>(new char[size_needed]), size_needed});
+            offset = 0;
+        }
+    }
+    
+    // Constructs a T in the arena. Its destructor runs on release(), never delete it.
+    // SineBasic objects are flagged in_arena, so the groups they are added to don't delete them either.
+    template<typename T, typename... Args>
+    T* create(Args&&... args) {
+        T* obj = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if constexpr(std::is_base_of<SineBasic, T>::value) obj->in_arena = true;
+        if(!std::is_trivially_destructible<T>::value) {
+            std::lock_guard<std::mutex> lock(mutex);
+            finalizers.push_back(Finalizer{obj, [](void* p) { static_cast<T*>(p)->~T(); }});
+        }
+        return obj;
+    }
+    
+    bool owns(const void* ptr) const {
+        for(const auto& block : blocks) {
+            if(ptr >= block.data.get() && ptr < block.data.get() + block.size) return true;
+        }
+        return false;
+    }
+    
+    size_t bytesReserved() const {
+        size_t total = 0;
+        for(const auto& block : blocks) total += block.size;
+        return total;
+    }
+    
+    // Destroys the objects made with create(), newest first, then frees every block but the first one for reuse
+    void release() {
+        for(int i = (int)finalizers.size() - 1; i >= 0; i--) {
+            finalizers[i].destroy(finalizers[i].object);
+        }
+        finalizers.clear();
+        if(blocks.size() > 1) blocks.resize(1);
+        offset = 0;
+    }
+    
+    ~SineArena() {
+        release();
+    }
+};
+
+// std allocator over a SineArena, for containers that live as long as the arena.
+// Deallocating does nothing, the memory comes back on SineArena::release(). Without an arena it uses the heap.
+template<typename T>
+struct SineArenaAllocator {
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    
+    SineArena* arena = nullptr;
+    
+    SineArenaAllocator() = default;
+    SineArenaAllocator(SineArena* arena) : arena(arena) {}
+    template<typename U>
+    SineArenaAllocator(const SineArenaAllocator<U>& other) : arena(other.arena) {}
+    
+    T* allocate(size_t n) {
+        if(arena) return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+        return std::allocator<T>().allocate(n);
+    }
+    
+    void deallocate(T* p, size_t n) {
+        if(!arena) std::allocator<T>().deallocate(p, n);
+    }
+    
+    template<typename U>
+    bool operator==(const SineArenaAllocator<U>& other) const { return arena == other.arena; }
+    template<typename U>
+    bool operator!=(const SineArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+// Stupid Rectangle hash function because C++ is too stupid to process anything... again
+struct RectangleHash {
+    std::size_t operator()(const Rectangle& rect) const {
+        std::size_t hx = std::hash<float>{}(rect.x);
+        std::size_t hy = std::hash<float>{}(rect.y);
+        std::size_t hw = std::hash<float>{}(rect.width);
+        std::size_t hh = std::hash<float>{}(rect.height);
+
+        // Combine hashes using a simple hash combining technique
+        return ((hx ^ (hy << 1)) >> 1) ^ (hw << 1) ^ (hh << 2);
+    }
+};
+
+// Packs integer cell (or chunk) coordinates in one key, for the maps and sorted lists of cells
+inline uint64_t SineCellKey(int x, int y) {
+    return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+}
+
+// Sparse occupancy grid of the solid tiles of a LDtk map.
+// Cells are addressed with integer tile coordinates and stored one bit per cell in 32x32 chunks,
+// kept in a hash map keyed by the chunk coordinates. Chunks without solid cells are never allocated,
+// so memory follows the solid area and not the size of the world.
+struct SineCollisionGrid {
+    static constexpr int CHUNK_SHIFT = 5;
+    static constexpr int CHUNK_SIZE = 1 << CHUNK_SHIFT;
+    static constexpr int CHUNK_MASK = CHUNK_SIZE - 1;
+    
+    struct Chunk {
+        uint32_t rows[CHUNK_SIZE] = {0};
+        int count = 0;  // Solid cells in the chunk
+    };
+    
+    // Bounds of the solid cells, in cells. They only grow until clear() is called.
+    int originX = 0, originY = 0;
+    int width = 0, height = 0;
+    std::unordered_map<uint64_t, Chunk> chunks;
+    // Goes up every time a cell changes, so caches built from the grid know when they are stale
+    uint32_t version = 0;
+    
+    const Chunk* chunkAt(int cx, int cy) const {
+        auto it = chunks.find(SineCellKey(cx, cy));
+        return it != chunks.end() ? &it->second : nullptr;
+    }
+    
+    void set(int x, int y, bool solid = true) {
+        uint32_t bit = (uint32_t)1 << (x & CHUNK_MASK);
+        if(solid) {
+            Chunk& chunk = chunks[SineCellKey(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT)];
+            uint32_t& row = chunk.rows[y & CHUNK_MASK];
+            if(row & bit) return;
+            row |= bit;
+            chunk.count++;
+            version++;
+            
+            if(width == 0) {
+                originX = x; originY = y; width = 1; height = 1;
+            }
+            else {
+                int maxX = std::max(originX + width, x + 1), maxY = std::max(originY + height, y + 1);
+                originX = std::min(originX, x); originY = std::min(originY, y);
+                width = maxX - originX; height = maxY - originY;
+            }
+        }
+        else {
+            auto it = chunks.find(SineCellKey(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT));
+            if(it == chunks.end()) return;
+            uint32_t& row = it->second.rows[y & CHUNK_MASK];
+            if(!(row & bit)) return;
+            row &= ~bit;
+            version++;
+            if(--it->second.count == 0) chunks.erase(it);
+        }
+    }
+    
+    bool isSolid(int x, int y) const {
+        const Chunk* chunk = chunkAt(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+        return chunk && ((chunk->rows[y & CHUNK_MASK] >> (x & CHUNK_MASK)) & 1);
+    }
+    
+    // Remembers the last chunk it looked up, for queries that walk through neighbouring cells
+    struct Reader {
+        const SineCollisionGrid* grid;
+        uint64_t key = ~(uint64_t)0;
+        const Chunk* chunk = nullptr;
+        
+        explicit Reader(const SineCollisionGrid& g) : grid(&g) {}
+        
+        bool isSolid(int x, int y) {
+            uint64_t k = SineCellKey(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+            if(k != key) {
+                key = k;
+                chunk = grid->chunkAt(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+            }
+            return chunk && ((chunk->rows[y & CHUNK_MASK] >> (x & CHUNK_MASK)) & 1);
+        }
+    };
+    
+    bool empty() const {
+        return chunks.empty();
+    }
+    
+    void clear() {
+        chunks.clear();
+        originX = originY = width = height = 0;
+        version++;
+    }
+    
+    // Calls func(x, y) for every solid cell of the region [x0, x1] x [y0, y1], row by row.
+    // Does one chunk lookup per row and chunk instead of one per cell.
+    template<typename Func>
+    void forEachSolidIn(int x0, int y0, int x1, int y1, Func&& func) const {
+        x0 = std::max(x0, originX); y0 = std::max(y0, originY);
+        x1 = std::min(x1, originX + width - 1); y1 = std::min(y1, originY + height - 1);
+        for(int y = y0; y <= y1; y++) {
+            for(int cx = x0 >> CHUNK_SHIFT; cx <= x1 >> CHUNK_SHIFT; cx++) {
+                const Chunk* chunk = chunkAt(cx, y >> CHUNK_SHIFT);
+                if(!chunk) continue;
+                int base = cx * CHUNK_SIZE;
+                uint32_t row = chunk->rows[y & CHUNK_MASK];
+                for(int x = std::max(x0, base); x <= std::min(x1, base + CHUNK_MASK) && row; x++) {
+                    if((row >> (x - base)) & 1) func(x, y);
+                }
+            }
+        }
+    }
+    
+    // Merges the solid cells of the region [x, x+w) x [y, y+h) greedily into maximal rectangles:
+    // runs of solid cells are grown to the right first, then down while the whole run stays solid.
+    // The rectangles are appended to out in world units, ordered by their top edge.
+    void greedyMerge(int x, int y, int w, int h, float tile_size, std::vector<Rectangle>& out) const {
+        if(w <= 0 || h <= 0) return;
+        std::vector<bool> used((size_t)w * h, false);
+        auto free_solid = [&](int cx, int cy) {
+            return !used[(size_t)cy * w + cx] && isSolid(x + cx, y + cy);
+        };
+        
+        for(int cy = 0; cy < h; cy++) {
+            for(int cx = 0; cx < w; cx++) {
+                if(!free_solid(cx, cy)) continue;
+                
+                int run = 1;
+                while(cx + run < w && free_solid(cx + run, cy)) run++;
+                
+                int rows = 1;
+                while(cy + rows < h) {
+                    bool full = true;
+                    for(int i = 0; i < run && full; i++) full = free_solid(cx + i, cy + rows);
+                    if(!full) break;
+                    rows++;
+                }
+                
+                for(int j = 0; j < rows; j++) {
+                    for(int i = 0; i < run; i++) used[(size_t)(cy + j) * w + cx + i] = true;
+                }
+                out.push_back(Rectangle{(x + cx)*tile_size, (y + cy)*tile_size, run*tile_size, rows*tile_size});
+                cx += run - 1;
+            }
+        }
+    }
+    
+    // Calls func(x, y) for every solid cell, chunk by chunk
+    template<typename Func>
+    void forEachSolid(Func&& func) const {
+        for(const auto& [key, chunk] : chunks) {
+            int baseX = (int)(uint32_t)(key >> 32) * CHUNK_SIZE;
+            int baseY = (int)(uint32_t)key * CHUNK_SIZE;
+            for(int y = 0; y < CHUNK_SIZE; y++) {
+                uint32_t row = chunk.rows[y];
+                for(int x = 0; row; x++, row >>= 1) {
+                    if(row & 1) func(baseX + x, baseY + y);
+                }
+            }
+        }
+    }
+};
+
+// The solid tiles of one LDtk level merged into bigger rectangles, sorted by their top edge
+struct SineLevelCollisionBoxes {
+    Rectangle bounds;
+    float max_height = 0;   // Tallest box, bounds the search window of the queries
+    std::vector<Rectangle, SineArenaAllocator<Rectangle>> boxes;    // In the state's arena
+};
+
+// A square of the map with its tile layers pre-rendered, drawn as one quad by DrawLDtkMap()
+struct SineTileChunk {
+    Rectangle bounds;
+    RenderTexture2D texture{};
+    bool baked = false;     // The texture was created
+    bool dirty = true;      // The tiles changed since the texture was drawn
+};
+
+// The tiles of one LDtk tile layer bucketed by grid cell, so drawing a part of the layer only visits its cells
+struct SineLayerTiles {
+    struct Tile {
+        Rectangle source;   // In the tileset
+        Vector2 position;   // In the level
+    };
+    
+    const ldtk::Layer* layer = nullptr;
+    const Texture2D* tileset = nullptr;
+    Vector2 offset;             // Of the layer in the level
+    float cell_size = 0;
+    float tile_size = 0;        // Tiles can be bigger than the cells
+    int width = 0, height = 0;  // In cells
+    std::vector<int> cell_start;    // Tiles of cell (x, y) are tiles[cell_start[i]] to tiles[cell_start[i + 1]], i = y * width + x
+    std::vector<Tile> tiles;
+    
+    // Calls func(tile) for the tiles overlapping area (in level coordinates), only visiting the cells around it
+    template<typename Func>
+    void forEachIn(Rectangle area, Func&& func) const {
+        if(width <= 0 || height <= 0 || cell_size <= 0) return;
+        // A tile at p covers [p, p + tile_size), so it reaches area from up to tile_size before it
+        int x0 = std::max((int)std::floor((area.x - offset.x - tile_size) / cell_size), 0);
+        int y0 = std::max((int)std::floor((area.y - offset.y - tile_size) / cell_size), 0);
+        int x1 = std::min((int)std::floor((area.x + area.width - offset.x) / cell_size), width - 1);
+        int y1 = std::min((int)std::floor((area.y + area.height - offset.y) / cell_size), height - 1);
+        if(x0 > x1 || y0 > y1) return; // area is outside the layer
+        for(int y = y0; y <= y1; y++) {
+            for(int i = cell_start[y * width + x0]; i < cell_start[y * width + x1 + 1]; i++) {
+                const Tile& tile = tiles[i];
+                if(CheckCollisionRecs(Rectangle{tile.position.x, tile.position.y, tile.source.width, tile.source.height}, area)) func(tile);
+            }
+        }
+    }
+};
+
+// The tile layers of one LDtk level, in the order LDtkLoader lists them
+struct SineLevelTiles {
+    const ldtk::Level* level = nullptr;
+    Rectangle bounds;
+    std::vector<SineLayerTiles> layers;
+};
+
+// Result of a raycast against the collision tiles
+struct SineRayHit {
+    bool hit = false;
+    int cellX = 0, cellY = 0;           // Tile coordinates of the solid cell that was hit
+    Vector2 point = Vector2{0, 0};      // Where the ray entered the cell
+    Vector2 normal = Vector2{0, 0};     // Side of the cell that was hit, zero if the ray started inside it
+    float distance = 0;                 // From the ray origin to point
+};
+
+// Distances towards one goal cell over the walkable (non solid) cells of a collision grid,
+// built with a single Dijkstra pass. Every agent heading for the goal reads its next step in O(1).
+struct SineFlowField {
+    int goalX = 0, goalY = 0;
+    int originX = 0, originY = 0;   // Region covered by the field, in cells
+    int width = 0, height = 0;
+    uint32_t version = 0;           // Version of the collision grid the field was built from
+    uint64_t last_used = 0;
+    std::vector<float> cost;        // INFINITY where the goal can't be reached
+    std::vector<int8_t> next;       // Index in SinePathfinder::NEIGHBOURS of the next step, -1 at the goal or if unreachable
+    
+    bool contains(int x, int y) const {
+        return x >= originX && y >= originY && x < originX + width && y < originY + height;
+    }
+};
+
+// A* paths and cached flow fields over the free cells of a SineCollisionGrid.
+// Movement is 8-connected and diagonals can't cut the corners of solid cells.
+class SinePathfinder
+{
+private:
+    struct Node {
+        float f;
+        int index;
+        bool operator<(const Node& other) const { return f > other.f; } // Min heap
+    };
+    
+    // Scratch buffers reused by every A* query, stamp marks which entries belong to the current search
+    std::vector<float> g;
+    std::vector<int> parent;
+    std::vector<uint32_t> stamp;
+    std::vector<bool> closed;
+    std::vector<Node> open;
+    uint32_t search = 0;
+    uint64_t uses = 0;
+    
+    // The searched region: the solid bounds plus a free border, grown to include the given cells,
+    // then cut to search_margin cells around them so big sparse worlds don't get a dense array over all of it
+    void region(const SineCollisionGrid& grid, int ax, int ay, int bx, int by, int& x, int& y, int& w, int& h) const {
+        int minX = std::min(ax, bx), minY = std::min(ay, by), maxX = std::max(ax, bx), maxY = std::max(ay, by);
+        int loX = minX, loY = minY, hiX = maxX, hiY = maxY;
+        if(grid.width > 0) {
+            loX = std::min(loX, grid.originX); loY = std::min(loY, grid.originY);
+            hiX = std::max(hiX, grid.originX + grid.width - 1); hiY = std::max(hiY, grid.originY + grid.height - 1);
+        }
+        loX--; loY--; hiX++; hiY++;
+        if(search_margin > 0) {
+            loX = std::max(loX, minX - search_margin); loY = std::max(loY, minY - search_margin);
+            hiX = std::min(hiX, maxX + search_margin); hiY = std::min(hiY, maxY + search_margin);
+        }
+        x = loX; y = loY;
+        w = hiX - loX + 1; h = hiY - loY + 1;
+    }
+    
+    // Can the step in direction d be taken from the free cell (x, y)
+    static bool canStep(SineCollisionGrid::Reader& reader, int x, int y, int d) {
+        int dx = NEIGHBOURS[d][0], dy = NEIGHBOURS[d][1];
+        if(reader.isSolid(x + dx, y + dy)) return false;
+        if(dx != 0 && dy != 0 && (reader.isSolid(x + dx, y) || reader.isSolid(x, y + dy))) return false;
+        return true;
+    }
+    
+    static float stepCost(int d) {
+        return d < 4 ? 1.f : 1.41421356f;
+    }
+    
+    static float octile(int ax, int ay, int bx, int by) {
+        float dx = (float)std::abs(ax - bx), dy = (float)std::abs(ay - by);
+        return (dx + dy) + (1.41421356f - 2) * std::fmin(dx, dy);
+    }
+    
+public:
+    // Opposite directions are next to each other, d ^ 1 reverses d
+    static constexpr int NEIGHBOURS[8][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {-1, -1}, {1, -1}, {-1, 1}};
+    // Flow fields kept in the cache before the least recently used one is dropped
+    size_t max_flow_fields = 16;
+    // Cells searched past the start and goal (A*) or around the goal (flow fields), 0 for the whole solid bounds.
+    // Paths needing a bigger detour aren't found, the default keeps a flow field under 2MB.
+    int search_margin = 256;
+    std::unordered_map<uint64_t, SineFlowField> flow_fields;
+    
+    // A* from cell (sx, sy) to cell (gx, gy). Writes the cells of the path, start and goal included, in out.
+    // Returns false and leaves out empty if there is no path.
+    bool findPath(const SineCollisionGrid& grid, int sx, int sy, int gx, int gy, std::vector<std::pair<int, int>>& out) {
+        out.clear();
+        SineCollisionGrid::Reader reader(grid);
+        if(reader.isSolid(sx, sy) || reader.isSolid(gx, gy)) return false;
+        
+        int ox, oy, w, h;
+        region(grid, sx, sy, gx, gy, ox, oy, w, h);
+        size_t size = (size_t)w * h;
+        if(stamp.size() < size) {
+            g.resize(size); parent.resize(size); closed.resize(size);
+            stamp.assign(size, 0);
+            search = 0;
+        }
+        if(++search == 0) { // Stamps wrapped around, start over
+            std::fill(stamp.begin(), stamp.end(), 0);
+            search = 1;
+        }
+        
+        auto touch = [&](int i) {
+            if(stamp[i] != search) {
+                stamp[i] = search; g[i] = INFINITY; parent[i] = -1; closed[i] = false;
+            }
+        };
+        
+        int start = (sy - oy) * w + (sx - ox), goal = (gy - oy) * w + (gx - ox);
+        open.clear();
+        touch(start);
+        g[start] = 0;
+        open.push_back(Node{octile(sx, sy, gx, gy), start});
+        
+        while(!open.empty()) {
+            std::pop_heap(open.begin(), open.end());
+            int current = open.back().index;
+            open.pop_back();
+            if(closed[current]) continue;
+            closed[current] = true;
+            if(current == goal) break;
+            
+            int cx = current % w + ox, cy = current / w + oy;
+            for(int d = 0; d < 8; d++) {
+                int nx = cx + NEIGHBOURS[d][0], ny = cy + NEIGHBOURS[d][1];
+                if(nx < ox || ny < oy || nx >= ox + w || ny >= oy + h) continue;
+                if(!canStep(reader, cx, cy, d)) continue;
+                
+                int n = (ny - oy) * w + (nx - ox);
+                touch(n);
+                float cost = g[current] + stepCost(d);
+                if(!closed[n] && cost < g[n]) {
+                    g[n] = cost;
+                    parent[n] = current;
+                    open.push_back(Node{cost + octile(nx, ny, gx, gy), n});
+                    std::push_heap(open.begin(), open.end());
+                }
+            }
+        }
+        
+        if(stamp[goal] != search || !closed[goal]) return false;
+        for(int i = goal; i != -1; i = parent[i]) {
+            out.push_back({i % w + ox, i / w + oy});
+        }
+        std::reverse(out.begin(), out.end());
+        return true;
+    }
+    
+    // Returns the flow field towards cell (gx, gy), building it only if there is none yet
+    // or the collision grid changed since it was built
+    const SineFlowField& flowField(const SineCollisionGrid& grid, int gx, int gy) {
+        uint64_t key = SineCellKey(gx, gy);
+        auto it = flow_fields.find(key);
+        if(it == flow_fields.end()) {
+            if(flow_fields.size() >= max_flow_fields) {
+                auto oldest = flow_fields.begin();
+                for(auto f = flow_fields.begin(); f != flow_fields.end(); ++f) {
+                    if(f->second.last_used < oldest->second.last_used) oldest = f;
+                }
+                flow_fields.erase(oldest);
+            }
+            it = flow_fields.emplace(key, SineFlowField{}).first;
+            buildFlowField(grid, gx, gy, it->second);
+        }
+        else if(it->second.version != grid.version) {
+            buildFlowField(grid, gx, gy, it->second);
+        }
+        it->second.last_used = ++uses;
+        return it->second;
+    }
+    
+    void buildFlowField(const SineCollisionGrid& grid, int gx, int gy, SineFlowField& field) {
+        SineCollisionGrid::Reader reader(grid);
+        field.goalX = gx; field.goalY = gy;
+        field.version = grid.version;
+        region(grid, gx, gy, gx, gy, field.originX, field.originY, field.width, field.height);
+        int ox = field.originX, oy = field.originY, w = field.width, h = field.height;
+        field.cost.assign((size_t)w * h, INFINITY);
+        field.next.assign((size_t)w * h, -1);
+        if(reader.isSolid(gx, gy)) return;
+        
+        // Dijkstra from the goal. Moves are symmetric, so walking the field backwards gives the path to the goal.
+        open.clear();
+        int goal = (gy - oy) * w + (gx - ox);
+        field.cost[goal] = 0;
+        open.push_back(Node{0, goal});
+        while(!open.empty()) {
+            std::pop_heap(open.begin(), open.end());
+            Node current = open.back();
+            open.pop_back();
+            if(current.f > field.cost[current.index]) continue;
+            
+            int cx = current.index % w + ox, cy = current.index / w + oy;
+            for(int d = 0; d < 8; d++) {
+                int nx = cx + NEIGHBOURS[d][0], ny = cy + NEIGHBOURS[d][1];
+                if(nx < ox || ny < oy || nx >= ox + w || ny >= oy + h) continue;
+                if(!canStep(reader, cx, cy, d)) continue;
+                
+                int n = (ny - oy) * w + (nx - ox);
+                float cost = current.f + stepCost(d);
+                if(cost < field.cost[n]) {
+                    field.cost[n] = cost;
+                    field.next[n] = (int8_t)(d ^ 1); // Opposite direction, back towards current
+                    open.push_back(Node{cost, n});
+                    std::push_heap(open.begin(), open.end());
+                }
+            }
+        }
+    }
+};
+
+// Sides of an entity, used as bit flags for its collision contacts
+enum SineSide : uint8_t {
+    SINE_NONE  = 0,
+    SINE_LEFT  = 1 << 0,
+    SINE_RIGHT = 1 << 1,
+    SINE_UP    = 1 << 2,
+    SINE_DOWN  = 1 << 3,
+    SINE_ANY   = SINE_LEFT | SINE_RIGHT | SINE_UP | SINE_DOWN
+};
+
+// Collision contacts of an entity for the current frame, one bit per side
+struct SineContacts {
+    uint8_t bits = SINE_NONE;
+    
+    bool has(uint8_t sides) const { return (bits & sides) != 0; }
+    void set(uint8_t sides) { bits |= sides; }
+    void clear() { bits = SINE_NONE; }
+    
+    // Compatibility with the old std::unordered_map<std::string, bool>, so collisions["down"] keeps working.
+    // Unknown names read as false and ignore writes.
+    struct Ref {
+        uint8_t& bits;
+        uint8_t side;
+        operator bool() const { return (bits & side) != 0; }
+        Ref& operator=(bool value) {
+            if(value) bits |= side;
+            else bits &= ~side;
+            return *this;
+        }
+    };
+    
+    static uint8_t side(const char* name) {
+        if(std::strcmp(name, "right") == 0) return SINE_RIGHT;
+        if(std::strcmp(name, "left") == 0) return SINE_LEFT;
+        if(std::strcmp(name, "down") == 0) return SINE_DOWN;
+        if(std::strcmp(name, "up") == 0) return SINE_UP;
+        return SINE_NONE;
+    }
+    
+    Ref operator[](const char* name) { return Ref{bits, side(name)}; }
+    Ref operator[](const std::string& name) { return Ref{bits, side(name.c_str())}; }
+    bool operator[](const char* name) const { return has(side(name)); }
+    bool operator[](const std::string& name) const { return has(side(name.c_str())); }
+};
+
+class SinePhysicsWorld;
+
+// Handle to a body of a SinePhysicsWorld. Stays valid while the body exists, even if others are removed.
+struct SineBody {
+    SinePhysicsWorld* world = nullptr;
+    int id = -1;
+    
+    bool valid() const;
+    Vector2 getPosition() const;
+    void setPosition(Vector2 position);
+    Vector2 getVelocity() const;
+    void setVelocity(Vector2 velocity);
+    void setAcceleration(float x);
+    void setDrag(Vector2 drag);
+    void setGravity(float gravity);
+    Rectangle getHitbox() const;
+    bool isTouching(uint8_t sides) const;
+};
+
+// Simple bodies (no virtual update, no texture) stored as structure of arrays and moved all at once.
+// It does the same integration and tile collisions as SineEntity::update, with SSE2 when it is available.
+//
+// NOTE: drag must be positive, like for SineEntity
+class SinePhysicsWorld
+{
+private:
+    std::vector<int> dense_of;      // Body id -> index in the arrays, -1 if removed
+    std::vector<int> id_of;         // Index in the arrays -> body id
+    std::vector<int> free_ids;
+    std::vector<float> previous;    // Scratch: x or y before the current axis moved
+    
+    // v = MoveTowards(v, 0, drag * dt), then v += a * dt and p += v * dt for every body
+    static void integrate(float* p, float* v, const float* a, const float* drag, float* prev, int count, float dt) {
+        int i = 0;
+#ifdef SINE_SSE2
+        const __m128 vdt = _mm_set1_ps(dt);
+        const __m128 sign_mask = _mm_set1_ps(-0.f);
+        for(; i + 4 <= count; i += 4) {
+            __m128 vel = _mm_loadu_ps(v + i);
+            __m128 sign = _mm_and_ps(vel, sign_mask);
+            __m128 speed = _mm_andnot_ps(sign_mask, vel);
+            speed = _mm_max_ps(_mm_sub_ps(speed, _mm_mul_ps(_mm_loadu_ps(drag + i), vdt)), _mm_setzero_ps());
+            vel = _mm_or_ps(speed, sign);
+            vel = _mm_add_ps(vel, _mm_mul_ps(_mm_loadu_ps(a + i), vdt));
+            __m128 pos = _mm_loadu_ps(p + i);
+            _mm_storeu_ps(prev + i, pos);
+            _mm_storeu_ps(p + i, _mm_add_ps(pos, _mm_mul_ps(vel, vdt)));
+            _mm_storeu_ps(v + i, vel);
+        }
+#endif
+        for(; i < count; i++) {
+            float speed = std::fmax(std::fabs(v[i]) - drag[i] * dt, 0);
+            v[i] = std::copysign(speed, v[i]) + a[i] * dt;
+            prev[i] = p[i];
+            p[i] += v[i] * dt;
+        }
+    }
+    
+    // Pushes the solid bodies out of the tiles they moved into along one axis, like SineEntity::update
+    void resolve(const SineCollisionGrid& grid, float tile_size, bool horizontal) {
+        float* p = horizontal ? x.data() : y.data();
+        float* v = horizontal ? vx.data() : vy.data();
+        const float* size = horizontal ? w.data() : h.data();
+        const float* cross = horizontal ? y.data() : x.data();
+        const float* cross_size = horizontal ? h.data() : w.data();
+        uint8_t side_plus = horizontal ? SINE_RIGHT : SINE_DOWN;
+        uint8_t side_minus = horizontal ? SINE_LEFT : SINE_UP;
+        
+        for(int i = 0; i < (int)x.size(); i++) {
+            if(!solid[i] || p[i] == previous[i]) continue;
+            float lo = std::fmin(previous[i], p[i]), hi = std::fmax(previous[i], p[i]) + size[i];
+            int a0 = (int)std::floor(lo / tile_size), a1 = (int)std::ceil(hi / tile_size) - 1;
+            int c0 = (int)std::floor(cross[i] / tile_size), c1 = (int)std::ceil((cross[i] + cross_size[i]) / tile_size) - 1;
+            auto visit = [&](int tx, int ty) {
+                float t = (horizontal ? tx : ty) * tile_size;
+                if(p[i] < t + tile_size && p[i] + size[i] > t) { // Still overlapping after the previous pushes
+                    if(v[i] > 0) { p[i] = t - size[i]; touching[i] |= side_plus; }
+                    if(v[i] < 0) { p[i] = t + tile_size; touching[i] |= side_minus; }
+                }
+            };
+            if(horizontal) grid.forEachSolidIn(a0, c0, a1, c1, visit);
+            else grid.forEachSolidIn(c0, a0, c1, a1, visit);
+            if(touching[i] & (side_plus | side_minus)) v[i] = 0;
+        }
+    }
+    
+public:
+    // Body data, indexed with index(id). The order changes when bodies are removed.
+    std::vector<float> x, y;            // Hitbox position
+    std::vector<float> w, h;            // Hitbox size
+    std::vector<float> vx, vy;
+    std::vector<float> ax;              // The Y acceleration is the gravity
+    std::vector<float> gravity;
+    std::vector<float> dragX, dragY;
+    std::vector<uint8_t> solid;
+    std::vector<uint8_t> touching;      // SineSide flags of the last step
+    
+    SineBody add(float px, float py, float width = 16, float height = 16, bool is_solid = true) {
+        int id;
+        if(!free_ids.empty()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+        }
+        else {
+            id = (int)dense_of.size();
+            dense_of.push_back(-1);
+        }
+        dense_of[id] = (int)x.size();
+        id_of.push_back(id);
+        
+        x.push_back(px); y.push_back(py);
+        w.push_back(width); h.push_back(height);
+        vx.push_back(0); vy.push_back(0);
+        ax.push_back(0);
+        gravity.push_back(0);
+        dragX.push_back(0); dragY.push_back(0);
+        solid.push_back(is_solid);
+        touching.push_back(SINE_NONE);
+        return SineBody{this, id};
+    }
+    
+    // Removes a body by moving the last one in its place
+    void remove(SineBody body) {
+        if(!contains(body.id)) return;
+        int i = dense_of[body.id];
+        int last = (int)x.size() - 1;
+        auto move_last = [&](auto& v) {
+            v[i] = v[last];
+            v.pop_back();
+        };
+        move_last(x); move_last(y); move_last(w); move_last(h);
+        move_last(vx); move_last(vy); move_last(ax); move_last(gravity);
+        move_last(dragX); move_last(dragY); move_last(solid); move_last(touching);
+        move_last(id_of);
+        if(i != last) dense_of[id_of[i]] = i;
+        dense_of[body.id] = -1;
+        free_ids.push_back(body.id);
+    }
+    
+    bool contains(int id) const {
+        return id >= 0 && id < (int)dense_of.size() && dense_of[id] >= 0;
+    }
+    
+    // Index of a body in the data arrays
+    int index(int id) const {
+        return dense_of[id];
+    }
+    
+    int size() const {
+        return (int)x.size();
+    }
+    
+    bool empty() const {
+        return x.empty();
+    }
+    
+    void clear() {
+        for(auto* v : {&x, &y, &w, &h, &vx, &vy, &ax, &gravity, &dragX, &dragY}) v->clear();
+        solid.clear(); touching.clear();
+        dense_of.clear(); id_of.clear(); free_ids.clear();
+    }
+    
+    // Moves every body by dt, X axis first then Y, colliding the solid ones with the tiles of grid
+    void step(float dt, const SineCollisionGrid& grid, float tile_size) {
+        int count = size();
+        if(count == 0) return;
+        previous.resize(count);
+        std::fill(touching.begin(), touching.end(), SINE_NONE);
+        
+        integrate(x.data(), vx.data(), ax.data(), dragX.data(), previous.data(), count, dt);
+        if(tile_size > 0) resolve(grid, tile_size, true);
+        
+        integrate(y.data(), vy.data(), gravity.data(), dragY.data(), previous.data(), count, dt);
+        if(tile_size > 0) resolve(grid, tile_size, false);
+    }
+};
+
+inline bool SineBody::valid() const { return world && world->contains(id); }
+inline Vector2 SineBody::getPosition() const { int i = world->index(id); return Vector2{world->x[i], world->y[i]}; }
+inline void SineBody::setPosition(Vector2 position) { int i = world->index(id); world->x[i] = position.x; world->y[i] = position.y; }
+inline Vector2 SineBody::getVelocity() const { int i = world->index(id); return Vector2{world->vx[i], world->vy[i]}; }
+inline void SineBody::setVelocity(Vector2 velocity) { int i = world->index(id); world->vx[i] = velocity.x; world->vy[i] = velocity.y; }
+inline void SineBody::setAcceleration(float x) { world->ax[world->index(id)] = x; }
+inline void SineBody::setDrag(Vector2 drag) { int i = world->index(id); world->dragX[i] = drag.x; world->dragY[i] = drag.y; }
+inline void SineBody::setGravity(float gravity) { world->gravity[world->index(id)] = gravity; }
+inline Rectangle SineBody::getHitbox() const { int i = world->index(id); return Rectangle{world->x[i], world->y[i], world->w[i], world->h[i]}; }
+inline bool SineBody::isTouching(uint8_t sides) const { return (world->touching[world->index(id)] & sides) != 0; }
+
+class SineEntity;
+
+// Collision categories are bits: an entity is in the categories of its category field and
+// only collides with the categories in its mask field
+constexpr uint32_t SINE_ALL_CATEGORIES = 0xFFFFFFFF;
+
+// Dynamic AABB tree (bounding volume hierarchy) over entity hitboxes.
+// Leaves hold fattened boxes, so small moves don't touch the tree, and the tree is kept balanced with rotations.
+// Queries cost O(log n) whatever the mix of entity sizes.
+class SineAABBTree
+{
+private:
+    struct Node {
+        Rectangle box;
+        int parent = -1;
+        int left = -1, right = -1;
+        int height = 0;     // 0 for leaves, -1 for free nodes
+        uint32_t categories = 0;    // Category of the leaf, or union of the categories below the node
+        SineEntity* entity = nullptr;
+        
+        bool isLeaf() const { return left == -1; }
+    };
+    
+    std::vector<Node> nodes;
+    int root = -1;
+    int free_list = -1;     // Free nodes are chained through their parent index
+    
+    static Rectangle combine(Rectangle a, Rectangle b) {
+        float x = std::fmin(a.x, b.x), y = std::fmin(a.y, b.y);
+        return Rectangle{x, y, std::fmax(a.x + a.width, b.x + b.width) - x, std::fmax(a.y + a.height, b.y + b.height) - y};
+    }
+    
+    static bool contains(Rectangle outer, Rectangle inner) {
+        return inner.x >= outer.x && inner.y >= outer.y &&
+               inner.x + inner.width <= outer.x + outer.width && inner.y + inner.height <= outer.y + outer.height;
+    }
+    
+    // Like CheckCollisionRecs, but touching boxes count, so queries never miss an edge case the narrowphase accepts
+    static bool touches(Rectangle a, Rectangle b) {
+        return a.x <= b.x + b.width && b.x <= a.x + a.width && a.y <= b.y + b.height && b.y <= a.y + a.height;
+    }
+    
+    static float perimeter(Rectangle r) {
+        return 2 * (r.width + r.height);
+    }
+    
+    int allocateNode() {
+        if(free_list == -1) {
+            nodes.push_back(Node{});
+            return (int)nodes.size() - 1;
+        }
+        int index = free_list;
+        free_list = nodes[index].parent;
+        nodes[index] = Node{};
+        return index;
+    }
+    
+    void freeNode(int index) {
+        nodes[index].parent = free_list;
+        nodes[index].height = -1;
+        nodes[index].entity = nullptr;
+        free_list = index;
+    }
+    
+    void refit(int index) {
+        Node& node = nodes[index];
+        node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+        node.box = combine(nodes[node.left].box, nodes[node.right].box);
+        node.categories = nodes[node.left].categories | nodes[node.right].categories;
+    }
+    
+    // Rotates the subtree at a if its children's heights differ by more than one, returns its new root
+    int balance(int a) {
+        Node& A = nodes[a];
+        if(A.isLeaf() || A.height < 2) return a;
+        
+        int b = A.left, c = A.right;
+        int diff = nodes[c].height - nodes[b].height;
+        if(diff > 1) return rotate(a, c);    // Right side too deep, promote c
+        if(diff < -1) return rotate(a, b);   // Left side too deep, promote b
+        return a;
+    }
+    
+    // Promotes child 'up' of a in place of a, a takes the shallower grandchild
+    int rotate(int a, int up) {
+        Node& U = nodes[up];
+        int f = U.left, g = U.right;
+        
+        U.parent = nodes[a].parent;
+        nodes[a].parent = up;
+        if(U.parent != -1) {
+            if(nodes[U.parent].left == a) nodes[U.parent].left = up;
+            else nodes[U.parent].right = up;
+        }
+        else {
+            root = up;
+        }
+        
+        // The deeper grandchild stays under up, the other one moves under a
+        int keep = nodes[f].height > nodes[g].height ? f : g;
+        int give = keep == f ? g : f;
+        U.left = a;
+        U.right = keep;
+        if(nodes[a].left == up) nodes[a].left = give;
+        else nodes[a].right = give;
+        nodes[give].parent = a;
+        
+        refit(a);
+        refit(up);
+        return up;
+    }
+    
+    void insertLeaf(int leaf) {
+        if(root == -1) {
+            root = leaf;
+            nodes[leaf].parent = -1;
+            return;
+        }
+        
+        // Walk down to the sibling that grows the tree's total perimeter the least
+        Rectangle box = nodes[leaf].box;
+        int index = root;
+        while(!nodes[index].isLeaf()) {
+            const Node& node = nodes[index];
+            float area = perimeter(node.box);
+            float combined = perimeter(combine(node.box, box));
+            float cost = 2 * combined;
+            float inheritance = 2 * (combined - area);
+            
+            auto child_cost = [&](int child) {
+                const Node& c = nodes[child];
+                float grown = perimeter(combine(box, c.box));
+                return (c.isLeaf() ? grown : grown - perimeter(c.box)) + inheritance;
+            };
+            float cost_left = child_cost(node.left), cost_right = child_cost(node.right);
+            if(cost < cost_left && cost < cost_right) break;
+            index = cost_left < cost_right ? node.left : node.right;
+        }
+        
+        int sibling = index;
+        int old_parent = nodes[sibling].parent;
+        int new_parent = allocateNode();
+        nodes[new_parent].parent = old_parent;
+        nodes[new_parent].box = combine(box, nodes[sibling].box);
+        nodes[new_parent].height = nodes[sibling].height + 1;
+        nodes[new_parent].categories = nodes[sibling].categories | nodes[leaf].categories;
+        nodes[new_parent].left = sibling;
+        nodes[new_parent].right = leaf;
+        nodes[sibling].parent = new_parent;
+        nodes[leaf].parent = new_parent;
+        if(old_parent != -1) {
+            if(nodes[old_parent].left == sibling) nodes[old_parent].left = new_parent;
+            else nodes[old_parent].right = new_parent;
+        }
+        else {
+            root = new_parent;
+        }
+        
+        for(index = nodes[leaf].parent; index != -1; index = nodes[index].parent) {
+            index = balance(index);
+            refit(index);
+        }
+    }
+    
+    void removeLeaf(int leaf) {
+        if(leaf == root) {
+            root = -1;
+            return;
+        }
+        
+        int parent = nodes[leaf].parent;
+        int grand = nodes[parent].parent;
+        int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+        if(grand != -1) {
+            if(nodes[grand].left == parent) nodes[grand].left = sibling;
+            else nodes[grand].right = sibling;
+            nodes[sibling].parent = grand;
+            freeNode(parent);
+            for(int index = grand; index != -1; index = nodes[index].parent) {
+                index = balance(index);
+                refit(index);
+            }
+        }
+        else {
+            root = sibling;
+            nodes[sibling].parent = -1;
+            freeNode(parent);
+        }
+    }
+    
+public:
+    // How much the leaves are grown on every side, and how far ahead of the movement
+    float margin = 4;
+    float displacement_multiplier = 2;
+    
+    // Adds an entity with its hitbox and category, returns its proxy id
+    int createProxy(Rectangle box, SineEntity* entity, uint32_t category = SINE_ALL_CATEGORIES) {
+        int leaf = allocateNode();
+        nodes[leaf].box = Rectangle{box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin};
+        nodes[leaf].entity = entity;
+        nodes[leaf].categories = category;
+        nodes[leaf].height = 0;
+        insertLeaf(leaf);
+        return leaf;
+    }
+    
+    void destroyProxy(int proxy) {
+        removeLeaf(proxy);
+        freeNode(proxy);
+    }
+    
+    // Updates a proxy to a new hitbox. Does nothing while the hitbox stays in the fattened box.
+    // Returns true if the proxy was reinserted.
+    bool moveProxy(int proxy, Rectangle box, Vector2 displacement) {
+        if(contains(nodes[proxy].box, box)) return false;
+        
+        removeLeaf(proxy);
+        Rectangle fat = Rectangle{box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin};
+        // Extend the box ahead of the movement so the next frames don't reinsert it again
+        float dx = displacement.x * displacement_multiplier, dy = displacement.y * displacement_multiplier;
+        if(dx < 0) fat.x += dx;
+        fat.width += std::fabs(dx);
+        if(dy < 0) fat.y += dy;
+        fat.height += std::fabs(dy);
+        nodes[proxy].box = fat;
+        insertLeaf(proxy);
+        return true;
+    }
+    
+    // Changes the category of a proxy and the unions above it
+    void setCategory(int proxy, uint32_t category) {
+        if(nodes[proxy].categories == category) return;
+        nodes[proxy].categories = category;
+        for(int index = nodes[proxy].parent; index != -1; index = nodes[index].parent) {
+            nodes[index].categories = nodes[nodes[index].left].categories | nodes[nodes[index].right].categories;
+        }
+    }
+    
+    SineEntity* getEntity(int proxy) const { return nodes[proxy].entity; }
+    uint32_t getCategory(int proxy) const { return nodes[proxy].categories; }
+    Rectangle getFatBox(int proxy) const { return nodes[proxy].box; }
+    int getHeight() const { return root == -1 ? 0 : nodes[root].height; }
+    
+    void clear() {
+        nodes.clear();
+        root = -1;
+        free_list = -1;
+    }
+    
+    // Calls func(proxy) for every leaf whose fattened box touches area and whose category is in mask.
+    // Subtrees without any category of mask are skipped whole.
+    template<typename Func>
+    void query(Rectangle area, Func&& func, uint32_t mask = SINE_ALL_CATEGORIES) const {
+        static thread_local std::vector<int> stack;
+        stack.clear();
+        if(root != -1) stack.push_back(root);
+        while(!stack.empty()) {
+            int index = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[index];
+            if(!(node.categories & mask) || !touches(node.box, area)) continue;
+            if(node.isLeaf()) {
+                func(index);
+            }
+            else {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+    
+    // Fraction along from -> to where the segment enters box, or -1 if it misses it
+    static float segmentEntry(Vector2 from, Vector2 to, Rectangle box, float max_t) {
+        float t_min = 0, t_max = max_t;
+        float origin[2] = {from.x, from.y}, delta[2] = {to.x - from.x, to.y - from.y};
+        float lo[2] = {box.x, box.y}, hi[2] = {box.x + box.width, box.y + box.height};
+        for(int axis = 0; axis < 2; axis++) {
+            if(delta[axis] == 0) {
+                if(origin[axis] < lo[axis] || origin[axis] > hi[axis]) return -1;
+                continue;
+            }
+            float t1 = (lo[axis] - origin[axis]) / delta[axis];
+            float t2 = (hi[axis] - origin[axis]) / delta[axis];
+            if(t1 > t2) std::swap(t1, t2);
+            t_min = std::fmax(t_min, t1);
+            t_max = std::fmin(t_max, t2);
+            if(t_min > t_max) return -1;
+        }
+        return t_min;
+    }
+    
+    // Calls func(proxy, max_t) for every leaf in mask whose fattened box the segment from -> to crosses.
+    // func returns the new max_t: the fraction of the segment still worth searching (return max_t to keep all of it).
+    template<typename Func>
+    void queryRay(Vector2 from, Vector2 to, Func&& func, uint32_t mask = SINE_ALL_CATEGORIES) const {
+        static thread_local std::vector<int> stack;
+        stack.clear();
+        float max_t = 1;
+        if(root != -1) stack.push_back(root);
+        while(!stack.empty()) {
+            int index = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[index];
+            if(!(node.categories & mask) || segmentEntry(from, to, node.box, max_t) < 0) continue;
+            if(node.isLeaf()) {
+                max_t = func(index, max_t);
+                if(max_t <= 0) return;
+            }
+            else {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+    
+    // Calls func(proxy) for every leaf
+    template<typename Func>
+    void forEachProxy(Func&& func) const {
+        for(int i = 0; i < (int)nodes.size(); i++) {
+            if(nodes[i].height == 0) func(i);
+        }
     }
 };
 
 class SineState;
 
+class SineGroup;
+class SineBasic;
+class SineSprite;
+
+// Type flags of the engine classes, set by their constructors, so hot loops check a byte instead of using dynamic_cast.
+// The game's own types get an id from SINE_TYPE instead (see sine_cast).
+enum SineType : uint8_t {
+    SINE_TYPE_BASIC = 0,
+    SINE_TYPE_ENTITY = 1 << 0,
+    SINE_TYPE_SPRITE = 1 << 1,
+    SINE_TYPE_GROUP = 1 << 2,
+    SINE_TYPE_STATE = 1 << 3
+};
+
+// Ids of the SineBasic classes, given the first time each class is used, and the id of the class each one inherits from
+constexpr uint32_t SINE_MAX_TYPES = 1024;
+constexpr uint32_t SINE_NO_TYPE = UINT32_MAX;
+
+inline uint32_t* SineTypeParents() {
+    static uint32_t parents[SINE_MAX_TYPES];
+    return parents;
+}
+
+inline uint32_t SineRegisterType(uint32_t parent) {
+    static std::atomic<uint32_t> count{0};
+    uint32_t id = count++;
+    if(id >= SINE_MAX_TYPES) {
+        std::cerr << "SineType: more than " << SINE_MAX_TYPES << " SineBasic classes\n";
+        std::abort();
+    }
+    SineTypeParents()[id] = parent;
+    return id;
+}
+
+template<typename T>
+inline uint32_t SineTypeId() {
+    static const uint32_t id = []() {
+        if constexpr(std::is_same<T, SineBasic>::value) {
+            return SineRegisterType(SINE_NO_TYPE);
+        }
+        else {
+            static_assert(std::is_base_of<typename T::SineBase, T>::value, "SINE_TYPE(Class, Base): Class must inherit from Base");
+            return SineRegisterType(SineTypeId<typename T::SineBase>());
+        }
+    }();
+    return id;
+}
+
+// True if the class with id type is target or inherits from it
+inline bool SineTypeIs(uint32_t type, uint32_t target) {
+    for(; type != SINE_NO_TYPE; type = SineTypeParents()[type]) {
+        if(type == target) return true;
+    }
+    return false;
+}
+
+// Declares the type of a SineBasic class for sine_cast, with the class it inherits from. Put it in the public part:
+//
+//     class Player : public SineSprite {
+//     public:
+//         SINE_TYPE(Player, SineSprite)
+//     };
+#define SINE_TYPE(Class, Base) \
+    using SineSelf = Class; \
+    using SineBase = Base; \
+    uint32_t sineTypeId() const override { return SineTypeId<Class>(); }
+
+// obj as a T, or nullptr if it isn't one, without RTTI. The engine classes with a SineType flag are checked with it,
+// the others walk up the SINE_TYPE ids of obj's class. T has to declare SINE_TYPE itself, or it doesn't compile.
+template<typename T>
+inline T* sine_cast(SineBasic* obj);
+
+// Reference to a SineBasic that knows when the object is gone: an index in a global slot table plus the generation
+// of the slot when the handle was issued. Deleting the object (or recycling it from a pool) bumps the generation,
+// so old handles resolve to nullptr instead of dangling. Both resolving and checking are O(1).
+struct SineHandle {
+    uint32_t index = 0;
+    uint32_t generation = 0;    // 0 is the null handle
+    
+    // The object, or nullptr if it was deleted since
+    SineBasic* get() const;
+    
+    // The object as a T, or nullptr if it was deleted since or isn't a T (see sine_cast)
+    template<typename T>
+    T* get() const {
+        return sine_cast<T>(get());
+    }
+    
+    bool valid() const {
+        return get() != nullptr;
+    }
+    
+    explicit operator bool() const {
+        return valid();
+    }
+    
+    bool operator==(const SineHandle& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const SineHandle& other) const { return !(*this == other); }
+};
+
+// Slot table behind SineHandle. Handles are issued by the groups and pools when an object is added to them.
+//
+// NOTE: issuing and releasing lock the table, resolving doesn't and is only safe while no handle is issued or released
+class SineHandleTable
+{
+private:
+    struct Slot {
+        SineBasic* object = nullptr;
+        uint32_t generation = 1;
+    };
+    
+    // Never destroyed, objects deleted by other static destructors at exit still release their slot
+    static std::vector<Slot>& slotList() {
+        static auto* slots = new std::vector<Slot>();
+        return *slots;
+    }
+    
+    static std::vector<uint32_t>& freeList() {
+        static auto* free_slots = new std::vector<uint32_t>();
+        return *free_slots;
+    }
+    
+    static std::mutex& tableMutex() {
+        static auto* mutex = new std::mutex();
+        return *mutex;
+    }
+    
+public:
+    static SineHandle issue(SineBasic* obj) {
+        std::lock_guard<std::mutex> lock(tableMutex());
+        auto& slots = slotList();
+        auto& free_slots = freeList();
+        uint32_t index;
+        if(!free_slots.empty()) {
+            index = free_slots.back();
+            free_slots.pop_back();
+        }
+        else {
+            index = (uint32_t)slots.size();
+            slots.push_back(Slot{});
+        }
+        slots[index].object = obj;
+        return SineHandle{index, slots[index].generation};
+    }
+    
+    // Makes every handle to the slot stale
+    static void release(SineHandle handle) {
+        if(!handle.generation) return;
+        std::lock_guard<std::mutex> lock(tableMutex());
+        auto& slots = slotList();
+        if(!handle.generation || handle.index >= slots.size() || slots[handle.index].generation != handle.generation) return;
+        Slot& slot = slots[handle.index];
+        slot.object = nullptr;
+        if(++slot.generation == 0) slot.generation = 1; // Never hand out the null generation
+        freeList().push_back(handle.index);
+    }
+    
+    static SineBasic* resolve(SineHandle handle) {
+        const auto& slots = slotList();
+        if(handle.index >= slots.size()) return nullptr;
+        const Slot& slot = slots[handle.index];
+        return slot.generation == handle.generation ? slot.object : nullptr;
+    }
+};
+
+inline SineBasic* SineHandle::get() const {
+    return SineHandleTable::resolve(*this);
+}
+
 class SineBasic
 {
 private:
@@ -46,8 +1348,25 @@ private:
 public:
     bool active = true;
     bool visible = true;
-    Camera2D* camera;
-    SineState* parent_state;
+    // False once killed, until revived
+    bool alive = true;
+    // Set by destroy(), the group deletes the object when compacting instead of keeping it dead
+    bool destroyed = false;
+    Camera2D* camera = nullptr;
+    SineState* parent_state = nullptr;
+    // Group the object was added to, and its index in that group's members (or dead list once killed)
+    SineGroup* group = nullptr;
+    int group_slot = -1;
+    // Index in the spatial_hash of its group at the last rebuild, so remove() can clear it in O(1)
+    int hash_slot = -1;
+    // Made with SineState::Spawn() or SineArena::create(), the arena destroys it
+    bool in_arena = false;
+    // Null until the object is added to a group or getHandle() is called
+    SineHandle handle;
+    // SineType flags of the object's class and of the classes it inherits from
+    static constexpr uint8_t TYPE = SINE_TYPE_BASIC;
+    uint8_t type_flags = SINE_TYPE_BASIC;
+    using SineSelf = SineBasic;
     
     SineBasic() {
         
@@ -61,15 +1380,62 @@ public:
         
     }
     
-    virtual void destroy() {
+    // Stops updating and drawing the object. Its group moves it out of its members at the end of the update,
+    // where revive() can bring it back.
+    virtual void kill() {
+        alive = false;
         active = false;
+        visible = false;
+    }
+    
+    // Brings a killed object back into its group's members
+    virtual void revive();
+    
+    // Kills the object, and has its group remove and delete it at the end of the update instead of keeping it
+    // for revive(). An object already dead is removed right away, or once its group is done iterating.
+    virtual void destroy();
+    
+    // Handle to this object, issued on the first call if no group did it yet
+    SineHandle getHandle() {
+        if(!handle.generation) handle = SineHandleTable::issue(this);
+        return handle;
+    }
+    
+    // Makes the handles to this object stale and gives it a new one, for objects reused as new ones (pools)
+    void reissueHandle() {
+        SineHandleTable::release(handle);
+        handle = SineHandleTable::issue(this);
+    }
+    
+    // True if the object has all the given SineType flags
+    bool is(uint8_t flags) const {
+        return (type_flags & flags) == flags;
+    }
+    
+    // SineTypeId() of the object's class, overridden by SINE_TYPE
+    virtual uint32_t sineTypeId() const {
+        return SineTypeId<SineBasic>();
     }
     
     virtual ~SineBasic() {
-        
+        SineHandleTable::release(handle);
     }
 };
 
+// Engine classes owning a SineType flag
+template<typename T>
+inline constexpr bool SineHasTypeFlag = std::is_same<T, SineEntity>::value || std::is_same<T, SineSprite>::value ||
+                                        std::is_same<T, SineGroup>::value || std::is_same<T, SineState>::value;
+
+template<typename T>
+inline T* sine_cast(SineBasic* obj) {
+    static_assert(std::is_same<typename T::SineSelf, T>::value, "sine_cast<T>: T has to declare SINE_TYPE(T, Base)");
+    if(!obj) return nullptr;
+    if constexpr(std::is_same<T, SineBasic>::value) return obj;
+    else if constexpr(SineHasTypeFlag<T>) return obj->is(T::TYPE) ? static_cast<T*>(obj) : nullptr;
+    else return SineTypeIs(obj->sineTypeId(), SineTypeId<T>()) ? static_cast<T*>(obj) : nullptr;
+}
+
 inline std::vector<Vector2> NEIGHBOUR_OFFSETS = {
     Vector2{-1, 1},
     Vector2{0, 1},
@@ -82,52 +1448,499 @@ inline std::vector<Vector2> NEIGHBOUR_OFFSETS = {
     Vector2{1, -1}
 };
 
+// Uniform grid over the bounds of a group's objects, used as a broadphase by overlap().
+// Objects are inserted, then build() sorts them by cell into plain vectors, so a rebuild every update doesn't allocate
+// once warmed up.
+struct SineSpatialHash {
+    struct Entry {
+        uint64_t key;
+        int index;
+        bool operator<(const Entry& other) const { return key < other.key; }
+    };
+    
+    struct Cell {
+        uint64_t key;
+        int first, last;        // [first, last) in entries
+        uint32_t categories;    // Union of the categories of the objects in the cell
+    };
+    
+    float cell_size = 64;
+    std::vector<SineBasic*> objects;
+    std::vector<Rectangle> bounds;              // Bounds of objects[i] when it was inserted
+    std::vector<uint32_t> categories;           // Category of objects[i]
+    std::vector<Entry> entries;                 // One per covered cell, sorted by cell
+    std::vector<Cell> cells;                    // The occupied cells, sorted by key
+    
+    void clear() {
+        objects.clear(); bounds.clear(); categories.clear(); entries.clear(); cells.clear();
+    }
+    
+    void insert(SineBasic* obj, Rectangle rect, uint32_t category = SINE_ALL_CATEGORIES) {
+        int index = (int)objects.size();
+        objects.push_back(obj);
+        obj->hash_slot = index;
+        bounds.push_back(rect);
+        categories.push_back(category);
+        int x0 = (int)std::floor(rect.x / cell_size), x1 = (int)std::floor((rect.x + rect.width) / cell_size);
+        int y0 = (int)std::floor(rect.y / cell_size), y1 = (int)std::floor((rect.y + rect.height) / cell_size);
+        for(int y = y0; y <= y1; y++) {
+            for(int x = x0; x <= x1; x++) {
+                entries.push_back(Entry{SineCellKey(x, y), index});
+            }
+        }
+    }
+    
+    void build() {
+        std::sort(entries.begin(), entries.end());
+        for(int i = 0; i < (int)entries.size();) {
+            int first = i;
+            uint32_t cell_categories = 0;
+            while(i < (int)entries.size() && entries[i].key == entries[first].key) {
+                cell_categories |= categories[entries[i].index];
+                i++;
+            }
+            cells.push_back(Cell{entries[first].key, first, i, cell_categories});
+        }
+    }
+    
+    // Calls func(SineBasic*, Rectangle bounds) once for every object in mask whose bounds overlap area.
+    // An object in several cells is only reported from the cell holding the top-left corner of the overlap.
+    // Cells without any category of mask are skipped whole.
+    template<typename Func>
+    void query(Rectangle area, Func&& func, uint32_t mask = SINE_ALL_CATEGORIES) const {
+        if(cells.empty()) return;
+        int x0 = (int)std::floor(area.x / cell_size), x1 = (int)std::floor((area.x + area.width) / cell_size);
+        int y0 = (int)std::floor(area.y / cell_size), y1 = (int)std::floor((area.y + area.height) / cell_size);
+        for(int y = y0; y <= y1; y++) {
+            for(int x = x0; x <= x1; x++) {
+                uint64_t k = SineCellKey(x, y);
+                auto it = std::lower_bound(cells.begin(), cells.end(), k, [](const Cell& cell, uint64_t k) { return cell.key < k; });
+                if(it == cells.end() || it->key != k || !(it->categories & mask)) continue;
+                for(int e = it->first; e < it->last; e++) {
+                    const Rectangle& b = bounds[entries[e].index];
+                    if(!objects[entries[e].index] || !(categories[entries[e].index] & mask) || !CheckCollisionRecs(area, b)) continue;
+                    if((int)std::floor(std::fmax(area.x, b.x) / cell_size) != x || (int)std::floor(std::fmax(area.y, b.y) / cell_size) != y) continue;
+                    func(objects[entries[e].index], b);
+                }
+            }
+        }
+    }
+};
+
 class SineGroup : public SineBasic
 {
 private:
+    // add(), remove() and revive() calls made while the group updates or draws, applied by commit() once it's over
+    std::vector<SineBasic*> pending_add;
+    std::vector<SineBasic*> pending_remove;
+    std::vector<SineBasic*> pending_revive;
+    std::mutex pending_mutex;
+    int iterating = 0;     // Nested update(), draw() and beginIteration() calls
+    // Parallel updates running, while any is the members of every group may be touched from the workers
+    static inline std::atomic<int> parallel_updates{0};
+    
+    // Changes to members wait for commit() while the group updates or draws, or while a parallel update runs
+    bool deferring() const {
+        return iterating || parallel_updates.load(std::memory_order_relaxed) > 0;
+    }
+    
+protected:
+    // Swaps list[slot] with the last object of list and pops it, keeping group_slot up to date
+    static void takeOutAt(std::vector<SineBasic*>& list, int slot) {
+        SineBasic* obj = list[slot];
+        list[slot] = list.back();
+        if(list[slot]) list[slot]->group_slot = slot;
+        list.pop_back();
+        if(obj) obj->group_slot = -1;
+    }
+    
+    // takeOutAt() from obj's group_slot, in O(1). False if obj isn't at its slot in list.
+    static bool takeOut(std::vector<SineBasic*>& list, SineBasic* obj) {
+        int slot = obj->group_slot;
+        if(slot < 0 || slot >= (int)list.size() || list[slot] != obj) return false;
+        takeOutAt(list, slot);
+        return true;
+    }
+    
+    // Gives obj the state and camera of the group, so pooled and nested members can collide with the tiles.
+    // A group outside of any state leaves them as they are, it passes its own on once added to a state.
+    virtual void adopt(SineBasic* obj) {
+        if(parent_state) setState(obj, parent_state, camera);
+    }
+    
+    // Sets the state and camera of obj, and of everything in it if it is a group
+    static void setState(SineBasic* obj, SineState* state, Camera2D* state_camera) {
+        obj->parent_state = state;
+        obj->camera = state_camera;
+        if(!obj->is(SINE_TYPE_GROUP)) return;
+        SineGroup* group = static_cast<SineGroup*>(obj);
+        for(auto* m : group->members) if(m) setState(m, state, state_camera);
+        for(auto* m : group->dead) setState(m, state, state_camera);
+        std::lock_guard<std::mutex> lock(group->pending_mutex);
+        for(auto* m : group->pending_add) setState(m, state, state_camera);
+    }
+    
+    // Takes the objects matching pred out of the members, killed ones and ones waiting to be added, without freeing them
+    template<typename Pred>
+    void forgetMembers(Pred&& pred) {
+        members.erase(std::remove_if(members.begin(), members.end(), pred), members.end());
+        dead.erase(std::remove_if(dead.begin(), dead.end(), pred), dead.end());
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        pending_add.erase(std::remove_if(pending_add.begin(), pending_add.end(), pred), pending_add.end());
+    }
+    
+    void putIn(std::vector<SineBasic*>& list, SineBasic* obj) {
+        obj->getHandle();
+        obj->group = this;
+        obj->group_slot = (int)list.size();
+        list.push_back(obj);
+    }
+    
+    void updateMembers(int begin, int end, float dt) {
+        for(int i = begin; i < end; i++) {
+            SineBasic* obj = members[i];
+            if(obj && obj->active) {
+                obj->update(dt);
+            }
+        }
+    }
+    
+    void commit() {
+        // Other groups' parallel members can still queue, take the lists out first
+        std::vector<SineBasic*> adds, revives, removes;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            adds.swap(pending_add);
+            revives.swap(pending_revive);
+            removes.swap(pending_remove);
+        }
+        for(auto* obj : adds) putIn(members, obj);
+        for(auto* obj : revives) reviveNow(obj);
+        // An object can be removed more than once before the commit (once per overlapping pair), delete it once
+        std::sort(removes.begin(), removes.end());
+        removes.erase(std::unique(removes.begin(), removes.end()), removes.end());
+        for(auto* obj : removes) removeNow(obj);
+    }
+    
+    void removeNow(SineBasic* obj) {
+        bool found = obj->group == this && (takeOut(members, obj) || takeOut(dead, obj));
+        if(!found) {
+            // Pushed in members by hand, without add()
+            auto it = std::find(members.begin(), members.end(), obj);
+            if(it == members.end()) return;
+            takeOutAt(members, (int)(it - members.begin()));
+        }
+        drop(obj);
+    }
+    
+    // Frees an object already taken out of the lists
+    void drop(SineBasic* obj) {
+        // Don't leave a dangling pointer in the broadphase until the next rebuild
+        int slot = obj->hash_slot;
+        if(slot >= 0 && slot < (int)spatial_hash.objects.size() && spatial_hash.objects[slot] == obj) {
+            spatial_hash.objects[slot] = nullptr;
+        }
+        obj->hash_slot = -1;
+        release(obj);
+    }
+    
+    void reviveNow(SineBasic* obj) {
+        if(takeOut(dead, obj)) putIn(members, obj);
+    }
+    
+    // Moves the members killed during the update to the dead list, so the next updates don't walk over them,
+    // and deletes the destroyed ones
+    void compact() {
+        for(int i = 0; i < (int)members.size();) {
+            SineBasic* obj = members[i];
+            if(obj && !obj->alive) {
+                // By index, group_slot is stale for members pushed by hand or added to another group since
+                takeOutAt(members, i);
+                if(obj->destroyed) drop(obj);
+                else putIn(dead, obj);
+            }
+            else {
+                i++;
+            }
+        }
+    }
+    
+    // Frees an object taken out by remove(). Objects living in the state's arena are left to it.
+    virtual void release(SineBasic* obj) {
+        if(!obj->in_arena) delete obj;
+    }
+    
+public:
+    std::vector<SineBasic*> members;
+    // Killed members, kept (and owned) by the group until they are revived or removed
+    std::vector<SineBasic*> dead;
+    // Updates the members on the worker threads of the job system.
+    // Only for members whose update touches their own data and reads shared data (like the tile collisions):
+    // add(), remove() and SineState::Spawn() are safe on any group since they are deferred until that group's
+    // next commit (the end of its update or draw), anything else shared is not.
+    bool parallel = false;
+    // Members per job in parallel mode, 0 lets the job system pick
+    int parallel_grain = 0;
+    // Keeps spatial_hash up to date with the hitboxes of the SineEntity members at the end of every update,
+    // so overlap() only tests the members near the entity
+    bool use_spatial_hash = false;
+    SineSpatialHash spatial_hash;
+
+    static constexpr uint8_t TYPE = SINE_TYPE_GROUP;
+    SINE_TYPE(SineGroup, SineBasic)
+    
+    SineGroup() {
+        type_flags |= TYPE;
+    }
+    
+    // Calls func(T*) for every active member that is a T (see sine_cast), and for the ones of nested groups if recursive
+    template<typename T, typename Func>
+    void forEachOf(Func&& func, bool recursive = false) {
+        for(auto* obj : members) {
+            if(!obj || !obj->active) continue;
+            if(T* t = sine_cast<T>(obj)) func(t);
+            if(recursive && obj->is(SINE_TYPE_GROUP)) static_cast<SineGroup*>(obj)->forEachOf<T>(func, true);
+        }
+    }
+    
+    // Adds a heap allocated object in a std::vector<SineBasic*>
+    //
+    // NOTE: always create objects with 'new' when adding to a Group.
+    // Objects added while the group updates, or while any group updates in parallel, are added at its next commit().
+    virtual void add(SineBasic* obj) {
+        adopt(obj);
+        if(deferring()) {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            pending_add.push_back(obj);
+            return;
+        }
+        putIn(members, obj);
+    }
+    
+    // Removes and deletes obj in O(1), the last member takes its place.
+    //
+    // NOTE: objects removed while the group updates or draws are deleted once it's over
+    void remove(SineBasic* obj) {
+        if(deferring()) {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            pending_remove.push_back(obj);
+            return;
+        }
+        removeNow(obj);
+    }
+    
+    // Removes the object behind handle, does nothing if it is already gone
+    void remove(SineHandle handle) {
+        if(SineBasic* obj = handle.get()) remove(obj);
+    }
+    
+    // True if the object behind handle still exists and is alive in this group's members, in O(1)
+    bool contains(SineHandle handle) const {
+        SineBasic* obj = handle.get();
+        if(!obj || !obj->alive || obj->group != this) return false;
+        int slot = obj->group_slot;
+        return slot >= 0 && slot < (int)members.size() && members[slot] == obj;
+    }
+    
+    // Moves a killed member back to members, revive() calls it
+    void reviveMember(SineBasic* obj) {
+        if(deferring()) {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            pending_revive.push_back(obj);
+            return;
+        }
+        reviveNow(obj);
+    }
+    
+    void update(float dt) override {
+        iterating++;
+        if(parallel) {
+            parallel_updates++;
+            SineJobSystem::get().parallel_for(0, (int)members.size(), [&](int begin, int end) {
+                updateMembers(begin, end, dt);
+            }, parallel_grain);
+            parallel_updates--;
+        }
+        else {
+            updateMembers(0, (int)members.size(), dt);
+        }
+        iterating--;
+        if(iterating) return; // Inside a beginIteration(), endIteration() commits
+        commit();
+        compact();
+        if(use_spatial_hash) buildSpatialHash();
+    }
+    
+    // Rebuilds spatial_hash from the current hitboxes. update() calls it when use_spatial_hash is on,
+    // call it again if members moved since.
+    void buildSpatialHash();
+    
+    void draw() override {
+        iterating++;
+        for(auto* obj : members) {
+            if(obj && obj->active && obj->visible) {
+                obj->draw();
+            }
+        }
+        iterating--;
+        if(!iterating) commit();
+    }
+    
+    // Defers add(), remove() and revive() like during update(), for code walking the members from outside
+    // (the overlap() sweep). endIteration() applies them once the outermost call ends.
+    void beginIteration() {
+        iterating++;
+    }
+    
+    void endIteration() {
+        if(--iterating == 0) commit();
+    }
+    
+    // Deletes the members, killed ones and ones waiting to be added. Objects living in the state's arena are left to it.
+    void deleteMembers() {
+        for(auto* m : members) if(m && !m->in_arena) delete m;
+        members.clear();
+        for(auto* m : dead) if(!m->in_arena) delete m;
+        dead.clear();
+        for(auto* m : pending_add) if(!m->in_arena) delete m;
+        pending_add.clear();
+    }
+    
+    ~SineGroup() {
+        deleteMembers();
+        // std::cout<<"\n\n CLEARING MEMBERS \n\n";
+    }
+};
+
+inline void SineBasic::revive() {
+    bool was_dead = !alive;
+    alive = true;
+    destroyed = false;
+    active = true;
+    visible = true;
+    if(was_dead && group) group->reviveMember(this);
+}
+
+inline void SineBasic::destroy() {
+    bool was_dead = !alive;
+    kill();
+    destroyed = true;
+    // compact() only walks the members, a dead object is in the dead list
+    if(was_dead && group) group->remove(this);
+}
+
+// Group of T objects living in preallocated contiguous blocks, for bullets, particles and anything spawned often.
+// recycle() hands out a killed object again instead of allocating one, so spawning costs nothing once warmed up.
+//
+// NOTE: never delete a pooled object, kill() it to give it back (remove() and destroy() do it too)
+template<typename T>
+class SineTypedGroup : public SineGroup
+{
+private:
+    std::vector<T*> blocks;
+    int block_size;
+    int used = 0;       // Objects constructed in the last block
+    
+    void allocateBlock() {
+        blocks.push_back(static_cast<T*>(::operator new(sizeof(T) * block_size, std::align_val_t(alignof(T)))));
+        used = 0;
+    }
+    
+protected:
+    void release(SineBasic* obj) override {
+        if(!owns(obj)) {
+            SineGroup::release(obj);
+            return;
+        }
+        obj->kill();
+        putIn(dead, obj);
+    }
+    
+public:
+    // Stops constructing new objects once there are max_size of them, 0 for no limit
+    int max_size = 0;
+    
+    SINE_TYPE(SineTypedGroup, SineGroup)
+    
+    // Allocates room for capacity objects up front, more blocks of that size are allocated if it runs out
+    explicit SineTypedGroup(int capacity = 64) : block_size(std::max(capacity, 1)) {
+        allocateBlock();
+    }
+    
+    bool owns(const SineBasic* obj) const {
+        for(T* block : blocks) {
+            if(obj >= block && obj < block + block_size) return true;
+        }
+        return false;
+    }
     
-public:
-    std::vector<SineBasic*> members;
-
-    SineGroup() {
-        
+    int size() const {
+        return ((int)blocks.size() - 1) * block_size + used;
     }
     
-    // Adds a heap allocated object in a std::vector<SineBasic*>
+    // Returns a killed object brought back to life, or a new one constructed with args if none is dead.
+    // Recycled objects keep their old fields, reset what the spawn needs (position, velocity...).
+    // Returns nullptr if max_size objects are alive.
     //
-    // NOTE: always create objects with 'new' when adding to a Group
-    virtual void add(SineBasic* obj) {
-        members.push_back(obj);
+    // NOTE: from the main thread only, parallel members can add() new objects instead
+    template<typename... Args>
+    T* recycle(Args&&... args) {
+        for(int i = (int)dead.size() - 1; i >= 0; i--) {
+            SineBasic* obj = dead[i];
+            if(obj->alive || !owns(obj)) continue; // Alive ones were revived during this update, and wait for commit()
+            obj->reissueHandle(); // Handles to the previous life of the object go stale
+            obj->revive();
+            return static_cast<T*>(obj);
+        }
+        
+        if(max_size > 0 && size() >= max_size) return nullptr;
+        if(used == block_size) allocateBlock();
+        T* obj = new(blocks.back() + used) T(std::forward<Args>(args)...);
+        used++;
+        add(obj);
+        return obj;
     }
     
-    void remove(SineBasic* obj) {
-        auto it = std::find(members.begin(), members.end(), obj);
-        if(it != members.end()) {
-            delete *it;
-            members.erase(it);
+    // Constructs count killed objects ahead of time, so not even the first recycle() calls construct them
+    template<typename... Args>
+    void preallocate(int count, Args&&... args) {
+        for(int i = 0; i < count && (max_size <= 0 || size() < max_size); i++) {
+            if(used == block_size) allocateBlock();
+            T* obj = new(blocks.back() + used) T(args...);
+            used++;
+            obj->kill();
+            adopt(obj);
+            putIn(dead, obj);
         }
     }
     
-    void update(float dt) override {
-        for(auto* obj : members) {
-            if(obj && obj->active) {
-                obj->update(dt);
-            }
+    ~SineTypedGroup() {
+        // The pooled objects aren't SineGroup's to delete, the others are. That includes the ones recycled
+        // during a parallel update that are still waiting for commit().
+        forgetMembers([this](SineBasic* obj) { return owns(obj); });
+        for(int b = 0; b < (int)blocks.size(); b++) {
+            int count = b == (int)blocks.size() - 1 ? used : block_size;
+            for(int i = 0; i < count; i++) blocks[b][i].~T();
+            ::operator delete(blocks[b], std::align_val_t(alignof(T)));
         }
     }
+};
+
+// Runs a SineEcsWorld as a member of a group or state: update() runs its systems, draw() its draw systems.
+// The world lives inside the scene, so it goes away with the state like the other members.
+class SineEcsScene : public SineBasic
+{
+public:
+    SineEcsWorld world;
     
-    void draw() override {
-        for(auto* obj : members) {
-            if(obj && obj->active && obj->visible) {
-                obj->draw();
-            }
-        }
+    SINE_TYPE(SineEcsScene, SineBasic)
+    
+    void update(float dt) override {
+        world.update(dt);
     }
     
-    ~SineGroup() {
-        for(auto* m : members) delete m;
-        members.clear();
-        // std::cout<<"\n\n CLEARING MEMBERS \n\n";
+    void draw() override {
+        world.draw();
     }
 };
 
@@ -135,33 +1948,163 @@ class SineStateManager;
 
 class SineState : public SineGroup
 {
+protected:
+    // Everything added to the state or to its groups gets the state and its camera
+    void adopt(SineBasic* obj) override {
+        setState(obj, this, &camera);
+    }
+    
 private:
-    ldtk::IntRect r;
     std::unordered_map<std::string, Texture2D> tilesets;
     bool ldtk_debug;
+    int dirty_ldtk_chunks = 0;
+    
+    // Draws the tiles of layer overlapping area (in world coordinates), with the level placed at level_pos and moved by -origin
+    void drawLDtkLayerIn(const SineLayerTiles& layer, Vector2 level_pos, Rectangle area, Vector2 origin) {
+        Rectangle local = Rectangle{area.x - level_pos.x, area.y - level_pos.y, area.width, area.height};
+        layer.forEachIn(local, [&](const SineLayerTiles::Tile& tile) {
+            DrawTextureRec(*layer.tileset, tile.source, Vector2{tile.position.x + level_pos.x - origin.x, tile.position.y + level_pos.y - origin.y}, WHITE);
+        });
+    }
+    
+    // Draws the tiles of every visible tile layer overlapping area, moved by -origin
+    void drawLDtkTilesIn(Rectangle area, Vector2 origin) {
+        for(const auto& level : ldtk_tiles) {
+            if(!CheckCollisionRecs(level.bounds, area)) continue;
+            Vector2 level_pos = Vector2{level.bounds.x, level.bounds.y};
+            for(int i = level.layers.size()-1; i>=0; i--) { // Reversed order because LDtkLoader takes the layers inverted.
+                if(level.layers[i].layer->isVisible()) drawLDtkLayerIn(level.layers[i], level_pos, area, origin);
+            }
+        }
+    }
+    
+    // Buckets the tiles of a tile layer by cell for SineLayerTiles::forEachIn()
+    SineLayerTiles indexLDtkLayer(const ldtk::Layer& layer) {
+        SineLayerTiles index;
+        index.layer = &layer;
+        index.tileset = &tilesets[layer.getTileset().name];
+        index.offset = Vector2{(float)layer.getOffset().x, (float)layer.getOffset().y};
+        index.cell_size = (float)layer.getCellSize();
+        index.tile_size = (float)layer.getTileset().tile_size;
+        index.width = layer.getGridSize().x;
+        index.height = layer.getGridSize().y;
+        
+        // Counting sort by cell, the tiles of a cell keep their order
+        const auto& tiles = layer.allTiles();
+        index.cell_start.assign(index.width * index.height + 1, 0);
+        auto cell_of = [&](const ldtk::Tile& tile) {
+            ldtk::IntPoint grid = tile.getGridPosition();
+            return std::clamp(grid.y, 0, index.height - 1) * index.width + std::clamp(grid.x, 0, index.width - 1);
+        };
+        for(const auto& tile : tiles) index.cell_start[cell_of(tile) + 1]++;
+        for(int i = 0; i < index.width * index.height; i++) index.cell_start[i + 1] += index.cell_start[i];
+        std::vector<int> next(index.cell_start.begin(), index.cell_start.end() - 1);
+        index.tiles.resize(tiles.size());
+        for(const auto& tile : tiles) {
+            ldtk::IntRect src = tile.getTextureRect();
+            index.tiles[next[cell_of(tile)]++] = SineLayerTiles::Tile{
+                Rectangle{(float)src.x, (float)src.y, (float)src.width, (float)src.height},
+                Vector2{(float)tile.getPosition().x, (float)tile.getPosition().y}
+            };
+        }
+        return index;
+    }
+    
+    SineRayHit raycast(Vector2 from, Vector2 to, SineCollisionGrid::Reader& reader) const {
+        SineRayHit result;
+        if(tile_size <= 0 || collisions_layer.empty()) return result;
+        
+        // Everything is done in tile units, t goes from 0 (from) to 1 (to)
+        float px = from.x / tile_size, py = from.y / tile_size;
+        float dx = (to.x - from.x) / tile_size, dy = (to.y - from.y) / tile_size;
+        int cellX = (int)std::floor(px), cellY = (int)std::floor(py);
+        int stepX = dx > 0 ? 1 : (dx < 0 ? -1 : 0);
+        int stepY = dy > 0 ? 1 : (dy < 0 ? -1 : 0);
+        float tDeltaX = stepX ? 1.f / std::fabs(dx) : INFINITY;
+        float tDeltaY = stepY ? 1.f / std::fabs(dy) : INFINITY;
+        float tMaxX = stepX > 0 ? (cellX + 1 - px) * tDeltaX : (stepX < 0 ? (px - cellX) * tDeltaX : INFINITY);
+        float tMaxY = stepY > 0 ? (cellY + 1 - py) * tDeltaY : (stepY < 0 ? (py - cellY) * tDeltaY : INFINITY);
+        
+        const int minX = collisions_layer.originX, maxX = collisions_layer.originX + collisions_layer.width;
+        const int minY = collisions_layer.originY, maxY = collisions_layer.originY + collisions_layer.height;
+        float t = 0;
+        Vector2 normal = Vector2{0, 0};
+        while(true) {
+            if(reader.isSolid(cellX, cellY)) {
+                result.hit = true;
+                result.cellX = cellX; result.cellY = cellY;
+                result.point = Vector2{from.x + (to.x - from.x) * t, from.y + (to.y - from.y) * t};
+                result.normal = normal;
+                result.distance = std::sqrt((to.x - from.x) * (to.x - from.x) + (to.y - from.y) * (to.y - from.y)) * t;
+                return result;
+            }
+            
+            // Stop once the ray left the solid bounds and is moving away from them
+            if((stepX >= 0 && cellX >= maxX) || (stepX <= 0 && cellX < minX) ||
+               (stepY >= 0 && cellY >= maxY) || (stepY <= 0 && cellY < minY)) {
+                return result;
+            }
+            
+            if(tMaxX < tMaxY) {
+                t = tMaxX; tMaxX += tDeltaX;
+                cellX += stepX;
+                normal = Vector2{(float)-stepX, 0};
+            }
+            else {
+                t = tMaxY; tMaxY += tDeltaY;
+                cellY += stepY;
+                normal = Vector2{0, (float)-stepY};
+            }
+            if(t > 1) return result;
+        }
+    }
 public:
     SineStateManager* manager;
     int stateIndex;
     Vector2 VirtualMousePosition;
     float scale = 0;
     float offsetX, offsetY;
+    // How far the simulation is between the last fixed step and the next one, from 0 to 1.
+    // Always 1 if the manager doesn't use a fixed timestep. See SineStateManager::SetFixedTimestep()
+    float interpolation_alpha = 1;
     
     Camera2D camera;
     
+    // Memory for the objects and data of this state, freed at once when the state is destroyed.
+    // Declared before everything that allocates from it, so it outlives them.
+    SineArena arena;
+    
     ldtk::Project ldtkProject;
-    const ldtk::World* world;
+    const ldtk::World* world = nullptr;
     const ldtk::Level* level_0;
     const ldtk::Layer* ground_layer;
     float tile_size = 0;
-    std::unordered_map<std::pair<float, float>, bool, FloatPairHash> collisions_layer;
+    SineCollisionGrid collisions_layer;
+    std::vector<SineLevelCollisionBoxes> collision_boxes;
+    // The tile layers pre-rendered in chunks of LDTK_CHUNK_SIZE pixels, so DrawLDtkMap() draws one quad per visible chunk
+    // instead of every tile. Costs LDTK_CHUNK_SIZE^2 * 4 bytes of VRAM per chunk with tiles, turn it off to draw tile by tile.
+    static constexpr int LDTK_CHUNK_SIZE = 512;
+    bool ldtk_chunk_cache = true;
+    std::unordered_map<uint64_t, SineTileChunk> ldtk_chunks;
+    // The tile layers of every level indexed by cell, for drawing only what the camera sees
+    std::vector<SineLevelTiles> ldtk_tiles;
+    SinePathfinder pathfinder;
+    // Opt-in storage for many simple bodies, stepped with the state before its members are updated
+    SinePhysicsWorld physics;
+    // Category of the map's collision tiles, entities without it in their mask go through them
+    uint32_t tiles_category = 1;
+    // Entities registered with RegisterEntity(), kept up to date at the end of every update
+    SineAABBTree entity_tree;
+    std::vector<SineEntity*> tree_entities;
+    std::unordered_map<std::string, Rectangle> entities;
     
-    // Adds a heap allocated object in a std::vector<SineBasic*>
-    //
-    // NOTE: always create objects with 'new' when adding to a Group
-    virtual void add(SineBasic* obj) {
-        obj->camera = &camera;
-        obj->parent_state = this;
-        SineGroup::add(obj);
+    // Constructs a T in the state's arena and adds it, instead of new + add().
+    // It is destroyed with the state, remove() only takes it out of the group. It can be moved to any group of the state.
+    template<typename T, typename... Args>
+    T* Spawn(Args&&... args) {
+        T* obj = arena.create<T>(std::forward<Args>(args)...);
+        add(obj);
+        return obj;
     }
     
     // Runs once when the State is loaded
@@ -175,17 +2118,26 @@ public:
         camera.zoom = 1;
     }
     
-    // Runs every frame
+    // Runs every frame before update(), even on the frames where a fixed timestep runs no update() at all.
+    // Read the per-frame input there (IsKeyPressed() and the like) and keep it for the next update(),
+    // with a fixed timestep the presses of the frames without an update are lost otherwise.
+    //
+    // NOTE: put this as the first line if the function is overriden as SineState::preUpdate(dt)
+    virtual void preUpdate(float dt) {
+        updateScreenScale();
+    }
+    
+    // Runs every frame, or every step with SineStateManager::SetFixedTimestep()
     //
     // NOTE: put this as the first line if the function is overriden as SineState::update(dt)
     virtual void update(float dt) {
-        scale = std::min((float)GetScreenWidth()/gameWidth, (float)GetScreenHeight()/gameHeight);
-        offsetX = ((float)GetScreenWidth() - (gameWidth * scale)) * 0.5f;
-        offsetY = ((float)GetScreenHeight() - (gameHeight * scale)) * 0.5f;
-        VirtualMousePosition.x = ((GetMouseX() - offsetX) / scale);
-        VirtualMousePosition.y = ((GetMouseY() - offsetY) / scale);
+        updateScreenScale();
         
+        physics.step(dt, collisions_layer, tile_size);
         SineGroup::update(dt);
+        UpdateEntityTree();
+        // Outside of the drawing, BeginTextureMode() would reset the camera
+        if(dirty_ldtk_chunks) BakeLDtkChunks();
     }
     
     // Runs every frame
@@ -195,106 +2147,268 @@ public:
         SineGroup::draw();
     }
     
-    // Make the camera follow a position
+    // Letterbox scale and offset of the window, and the mouse position in game coordinates
+    void updateScreenScale() {
+        scale = std::min((float)GetScreenWidth()/gameWidth, (float)GetScreenHeight()/gameHeight);
+        offsetX = ((float)GetScreenWidth() - (gameWidth * scale)) * 0.5f;
+        offsetY = ((float)GetScreenHeight() - (gameHeight * scale)) * 0.5f;
+        VirtualMousePosition.x = ((GetMouseX() - offsetX) / scale);
+        VirtualMousePosition.y = ((GetMouseY() - offsetY) / scale);
+    }
+    
+    // Make the camera follow a position. The camera isn't interpolated: on a fixed timestep,
+    // follow the target's getRenderPosition() in draw() so it doesn't jitter against the sprites
     void CameraFollow(Vector2 pos) {
         camera.target = Vector2{std::round(pos.x), std::round(pos.y)};
     }
     
+    // The part of the world the camera shows on the gameWidth x gameHeight screen (the bounding box if it is rotated)
+    Rectangle GetCameraView() const {
+        float zoom = camera.zoom != 0 ? camera.zoom : 1;
+        Camera2D cam = camera;
+        cam.zoom = zoom;
+        Vector2 corners[4] = {
+            GetScreenToWorld2D(Vector2{0, 0}, cam),
+            GetScreenToWorld2D(Vector2{(float)gameWidth, 0}, cam),
+            GetScreenToWorld2D(Vector2{0, (float)gameHeight}, cam),
+            GetScreenToWorld2D(Vector2{(float)gameWidth, (float)gameHeight}, cam)
+        };
+        float minX = corners[0].x, maxX = corners[0].x, minY = corners[0].y, maxY = corners[0].y;
+        for(const auto& c : corners) {
+            minX = std::fmin(minX, c.x); maxX = std::fmax(maxX, c.x);
+            minY = std::fmin(minY, c.y); maxY = std::fmax(maxY, c.y);
+        }
+        return Rectangle{minX, minY, maxX - minX, maxY - minY};
+    }
+    
     // Loads a LDtk map
     //
     // NOTE: tilesets are loaded relative to the file path of the .ldtk file. File paths can be found in the .ldtk file.
     // The tileset paths are printed in the command line to see.
+    //
+    // NOTE: in ldtk the entities need to have a CUSTOM FIELD called "Name" <- exactly written like this for it to work
     void LoadLDtkMap(const char* tilemap_path, float fixed_tile_size, std::vector<std::string> collision_layer_names) {
+        UnloadLDtkChunks();
+        ldtk_tiles.clear();
         ldtkProject.loadFromFile(tilemap_path);
         world = &ldtkProject.getWorld();
         
         tile_size = fixed_tile_size;
+        collisions_layer.clear();
         for(const auto& level : world->allLevels()) {
-            if(!collision_layer_names.empty()) {
-                for(auto name : collision_layer_names) {
-                    for(const auto& tile : level.getLayer(name).allTiles()) {
-                        collisions_layer.insert({std::make_pair(tile.getGridPosition().x + level.position.x/tile_size, tile.getGridPosition().y + level.position.y/tile_size), true});
-                    }
+            int levelX = (int)std::floor(level.position.x / tile_size);
+            int levelY = (int)std::floor(level.position.y / tile_size);
+            for(const auto& name : collision_layer_names) {
+                for(const auto& tile : level.getLayer(name).allTiles()) {
+                    collisions_layer.set(tile.getGridPosition().x + levelX, tile.getGridPosition().y + levelY);
                 }
             }
-            else break;
         }
+        BuildCollisionBoxes();
         
         // This block of code takes the tilemap_path and erases the map.ldtk part.
         // After that, the tileset path from the ldtk layer is appended to it, forming the path to the tileset.
         // EXAMPLE: tilemaps/map.ldtk + ../tilesets/tileset_1.png = tilemaps/../tilesets/tileset_1.png
+        //
+        // The entities are also extracted in an unordered_map for later use.
         for(const auto& level : world->allLevels()) {
+            ldtk_tiles.push_back(SineLevelTiles{&level, Rectangle{(float)level.position.x, (float)level.position.y, (float)level.size.x, (float)level.size.y}, {}});
             for(const auto& layer : level.allLayers()) {
-                if(tilesets.find(layer.getTileset().name) == tilesets.end()) {
-                    std::string texture_file_name = layer.getTileset().path; // Load file path relative to the .ldtk file
-                    std::string map_path = tilemap_path;
-                    for(int i = map_path.size()-1; i>=0; i--) {
-                        if(map_path[i-1] == '/') {      // When the '/' is next...
-                            map_path.erase(i);          // ...then erase.
-                            break;
+                if(layer.getType() != ldtk::LayerType::Entities) {
+                    if(tilesets.find(layer.getTileset().name) == tilesets.end()) {
+                        std::string texture_file_name = layer.getTileset().path; // Load file path relative to the .ldtk file
+                        std::string map_path = tilemap_path;
+                        for(int i = map_path.size()-1; i>=0; i--) {
+                            if(map_path[i-1] == '/') {      // When the '/' is next...
+                                map_path.erase(i);          // ...then erase.
+                                break;
+                            }
                         }
+                        
+                        map_path.append(texture_file_name); // Combine the two file paths.
+                        tilesets.insert({layer.getTileset().name, LoadTexture(map_path.c_str())}); // Insert the name and load the tileset.
+                        std::cout<<"\nTILESET PATH:\n"<<map_path<<"\n\n";
                     }
+                    ldtk_tiles.back().layers.push_back(indexLDtkLayer(layer));
                     
-                    map_path.append(texture_file_name); // Combine the two file paths.
-                    tilesets.insert({layer.getTileset().name, LoadTexture(map_path.c_str())}); // Insert the name and load the tileset.
-                    std::cout<<"\nTILESET PATH:\n"<<map_path<<"\n\n";
+                    // Every chunk this layer has tiles in
+                    if(layer.isVisible()) {
+                        for(const auto& tile : layer.allTiles()) {
+                            int chunkX = (int)std::floor((tile.getPosition().x + level.position.x) / (float)LDTK_CHUNK_SIZE);
+                            int chunkY = (int)std::floor((tile.getPosition().y + level.position.y) / (float)LDTK_CHUNK_SIZE);
+                            int chunkX1 = (int)std::floor((tile.getPosition().x + level.position.x + tile.getTextureRect().width - 1) / (float)LDTK_CHUNK_SIZE);
+                            int chunkY1 = (int)std::floor((tile.getPosition().y + level.position.y + tile.getTextureRect().height - 1) / (float)LDTK_CHUNK_SIZE);
+                            for(int cy = chunkY; cy <= chunkY1; cy++) {
+                                for(int cx = chunkX; cx <= chunkX1; cx++) {
+                                    ldtk_chunks.try_emplace(SineCellKey(cx, cy), SineTileChunk{Rectangle{(float)cx * LDTK_CHUNK_SIZE, (float)cy * LDTK_CHUNK_SIZE, (float)LDTK_CHUNK_SIZE, (float)LDTK_CHUNK_SIZE}});
+                                }
+                            }
+                        }
+                    }
+                }
+                else {
+                    // Saving ldtk entities as an element with Name, Position and Size in an unordered_map
+                    for(const auto& ent : layer.allEntities()) {
+                        entities.insert({
+                            ent.getField<std::string>("Name").value(),
+                            Rectangle{
+                                (float)ent.getPosition().x + level.position.x,
+                                (float)ent.getPosition().y + level.position.y,
+                                (float)ent.getSize().x,
+                                (float)ent.getSize().y
+                            }
+                        });
+                    }
                 }
             }
         }
+        
+        dirty_ldtk_chunks = (int)ldtk_chunks.size();
+        BakeLDtkChunks();
     }
     
-    // Draws the entire LDtk map
-    void DrawLDtkMap() {
+    // Draws the dirty tile chunks into their textures. LoadLDtkMap() and update() call it.
+    //
+    // NOTE: not between BeginMode2D() and EndMode2D(), drawing into a texture resets the camera
+    void BakeLDtkChunks() {
+        // Dirty chunks stay counted while the cache is off, so turning it on bakes them
+        if(!ldtk_chunk_cache || world == nullptr) return;
+        dirty_ldtk_chunks = 0;
+        for(auto& [key, chunk] : ldtk_chunks) {
+            if(!chunk.dirty) continue;
+            if(!chunk.baked) {
+                chunk.texture = LoadRenderTexture(LDTK_CHUNK_SIZE, LDTK_CHUNK_SIZE);
+                chunk.baked = true;
+            }
+            BeginTextureMode(chunk.texture);
+                ClearBackground(BLANK);
+                drawLDtkTilesIn(chunk.bounds, Vector2{chunk.bounds.x, chunk.bounds.y});
+            EndTextureMode();
+            chunk.dirty = false;
+        }
+    }
+    
+    // Re-bakes the chunks overlapping area at the next update, after changing what the tiles there look like
+    void MarkLDtkChunksDirty(Rectangle area) {
+        for(auto& [key, chunk] : ldtk_chunks) {
+            if(CheckCollisionRecs(chunk.bounds, area) && !chunk.dirty) {
+                chunk.dirty = true;
+                dirty_ldtk_chunks++;
+            }
+        }
+    }
+    
+    void UnloadLDtkChunks() {
+        for(auto& [key, chunk] : ldtk_chunks) {
+            if(chunk.baked) UnloadRenderTexture(chunk.texture);
+        }
+        ldtk_chunks.clear();
+        dirty_ldtk_chunks = 0;
+    }
+    
+    // Merges the solid tiles of every level into collision boxes. LoadLDtkMap calls it.
+    //
+    // NOTE: call it again after editing collisions_layer by hand, the old boxes stay in the arena until the state goes
+    void BuildCollisionBoxes() {
+        collision_boxes.clear();
+        if(tile_size <= 0 || world == nullptr) return;
+        
+        static thread_local std::vector<Rectangle> merged;
         for(const auto& level : world->allLevels()) {
-            for(int i = level.allLayers().size()-1; i>=0; i--) { // Reversed order because LDtkLoader takes the layers inverted.
-                std::string ts_name = level.allLayers()[i].getTileset().name; // Get the tileset name of the current layer.
-                if(level.allLayers()[i].isVisible()) {
-                    for(const auto& tile : level.allLayers()[i].allTiles()) { // Draw all tiles based on their source rect.
-                        r = tile.getTextureRect(); // source rect
-                        DrawTextureRec(
-                            tilesets[ts_name],
-                            Rectangle{(float)r.x, (float)r.y, (float)r.width, (float)r.height},
-                            Vector2{(float)tile.getPosition().x + level.position.x, (float)tile.getPosition().y + level.position.y},
-                            WHITE
-                        );
-                    }
-                }
+            SineLevelCollisionBoxes level_boxes{Rectangle{}, 0, std::vector<Rectangle, SineArenaAllocator<Rectangle>>(SineArenaAllocator<Rectangle>(&arena))};
+            level_boxes.bounds = Rectangle{(float)level.position.x, (float)level.position.y, (float)level.size.x, (float)level.size.y};
+            
+            int levelX = (int)std::floor(level.position.x / tile_size);
+            int levelY = (int)std::floor(level.position.y / tile_size);
+            int levelW = (int)std::ceil((level.position.x + level.size.x) / tile_size) - levelX;
+            int levelH = (int)std::ceil((level.position.y + level.size.y) / tile_size) - levelY;
+            merged.clear();
+            collisions_layer.greedyMerge(levelX, levelY, levelW, levelH, tile_size, merged);
+            level_boxes.boxes.assign(merged.begin(), merged.end()); // One allocation of the exact size in the arena
+            
+            for(const auto& box : level_boxes.boxes) {
+                level_boxes.max_height = std::fmax(level_boxes.max_height, box.height);
+            }
+            collision_boxes.push_back(std::move(level_boxes));
+        }
+    }
+    
+    // Calls func(Rectangle) for every merged collision box overlapping area.
+    // Levels that miss the area are skipped and the boxes of a level are binary searched by their top edge.
+    template<typename Func>
+    void for_each_collision_box_in(Rectangle area, Func&& func) const {
+        for(const auto& level_boxes : collision_boxes) {
+            if(!CheckCollisionRecs(level_boxes.bounds, area)) continue;
+            
+            const auto& boxes = level_boxes.boxes;
+            auto it = std::lower_bound(boxes.begin(), boxes.end(), area.y - level_boxes.max_height, [](const Rectangle& box, float top) {
+                return box.y < top;
+            });
+            for(; it != boxes.end() && it->y < area.y + area.height; ++it) {
+                if(CheckCollisionRecs(*it, area)) func(*it);
+            }
+        }
+    }
+    
+    Rectangle getLDtkEntity(std::string Name_field) {
+        Rectangle rect = Rectangle{0, 0, 0, 0};
+        if(entities[Name_field].width != 0) {
+            rect = Rectangle{entities[Name_field].x, entities[Name_field].y, entities[Name_field].width, entities[Name_field].height};
+            return rect;
+        }
+        return rect;
+    }
+    
+    // Draws the part of the LDtk map the camera sees, from the baked chunks of the tile layers when ldtk_chunk_cache is on
+    void DrawLDtkMap() {
+        Rectangle view = GetCameraView();
+        int x0 = (int)std::floor(view.x / LDTK_CHUNK_SIZE), x1 = (int)std::floor((view.x + view.width) / LDTK_CHUNK_SIZE);
+        int y0 = (int)std::floor(view.y / LDTK_CHUNK_SIZE), y1 = (int)std::floor((view.y + view.height) / LDTK_CHUNK_SIZE);
+        // Until every visible chunk is baked (the cache was just turned on) the tiles are drawn directly
+        bool baked = ldtk_chunk_cache && !ldtk_chunks.empty();
+        for(int y = y0; y <= y1 && baked; y++) {
+            for(int x = x0; x <= x1 && baked; x++) {
+                auto it = ldtk_chunks.find(SineCellKey(x, y));
+                if(it != ldtk_chunks.end() && !it->second.baked) baked = false;
+            }
+        }
+        if(!baked) {
+            drawLDtkTilesIn(view, Vector2{0, 0});
+            return;
+        }
+        
+        for(int y = y0; y <= y1; y++) {
+            for(int x = x0; x <= x1; x++) {
+                auto it = ldtk_chunks.find(SineCellKey(x, y));
+                if(it == ldtk_chunks.end()) continue;
+                const SineTileChunk& chunk = it->second;
+                // Render textures are upside down
+                DrawTextureRec(chunk.texture.texture, Rectangle{0, 0, (float)LDTK_CHUNK_SIZE, -(float)LDTK_CHUNK_SIZE}, Vector2{chunk.bounds.x, chunk.bounds.y}, WHITE);
             }
         }
     }
     
-    // Draws only the named level
+    // Draws only the named level, at the origin of the world
     void DrawLDtkLevel(const char* level_name) {
-        for(int i = world->getLevel(level_name).allLayers().size()-1; i>=0; i--) {
-            std::string ts_name = world->getLevel(level_name).allLayers()[i].getTileset().name;
-            if(world->getLevel(level_name).allLayers()[i].isVisible()) {
-                for(const auto& tile : world->getLevel(level_name).allLayers()[i].allTiles()) {
-                    r = tile.getTextureRect();
-                    DrawTextureRec(
-                        tilesets[ts_name],
-                        Rectangle{(float)r.x, (float)r.y, (float)r.width, (float)r.height},
-                        Vector2{(float)tile.getPosition().x, (float)tile.getPosition().y},
-                        WHITE
-                    );
-                }
+        Rectangle view = GetCameraView();
+        for(const auto& level : ldtk_tiles) {
+            if(level.level->name != level_name) continue;
+            if(!CheckCollisionRecs(Rectangle{0, 0, level.bounds.width, level.bounds.height}, view)) return;
+            for(int i = level.layers.size()-1; i>=0; i--) {
+                if(level.layers[i].layer->isVisible()) drawLDtkLayerIn(level.layers[i], Vector2{0, 0}, view, Vector2{0, 0});
             }
+            return;
         }
     }
     
-    // Draws a layer from all levels
+    // Draws a layer from all levels (exception is entities layer)
     void DrawLDtkLayer(const char* layer_name) {
-        for(const auto& level : world->allLevels()) {
-            std::string ts_name = level.getLayer(layer_name).getTileset().name;
-            if(level.getLayer(layer_name).isVisible()) {
-                for(const auto& tile : level.getLayer(layer_name).allTiles()) {
-                    r = tile.getTextureRect();
-                    DrawTextureRec(
-                        tilesets[ts_name],
-                        Rectangle{(float)r.x, (float)r.y, (float)r.width, (float)r.height},
-                        Vector2{(float)tile.getPosition().x + level.position.x, (float)tile.getPosition().y + level.position.y},
-                        WHITE
-                    );
-                }
+        Rectangle view = GetCameraView();
+        for(const auto& level : ldtk_tiles) {
+            if(!CheckCollisionRecs(level.bounds, view)) continue;
+            for(const auto& layer : level.layers) {
+                if(layer.layer->getName() != layer_name || !layer.layer->isVisible()) continue;
+                drawLDtkLayerIn(layer, Vector2{level.bounds.x, level.bounds.y}, view, Vector2{0, 0});
             }
         }
     }
@@ -305,20 +2419,138 @@ public:
             ldtk_debug = !ldtk_debug;
         }
         
-        if(ldtk_debug && !collisions_layer.empty()) {
-            for(auto tile : collisions_layer) {
-                DrawRectangleLinesEx(Rectangle{tile.first.first*tile_size, tile.first.second*tile_size, tile_size, tile_size}, 2, RED);
+        if(ldtk_debug) {
+            for(const auto& level_boxes : collision_boxes) {
+                for(const auto& box : level_boxes.boxes) {
+                    DrawRectangleLinesEx(box, 2, RED);
+                }
             }
         }
     }
     
     // ===================================================== LDTK MAP COLLISIONS ===================================================== //
-    std::vector<Vector2> tiles_around(Vector2 pos, float tile_size, std::unordered_map<std::pair<float, float>, bool, FloatPairHash> collisions_layer) {
+    // Calls func(Rectangle) for every solid tile in the 3x3 neighbourhood of pos.
+    // Reads the collision grid only, nothing is allocated.
+    template<typename Func>
+    void for_each_physics_rect_around(Vector2 pos, Func&& func) const {
+        if(tile_size <= 0) return; // No map loaded
+        int tile_x = (int)std::floor(pos.x / tile_size);
+        int tile_y = (int)std::floor(pos.y / tile_size);
+        for(const auto& offset : NEIGHBOUR_OFFSETS) {
+            int check_x = tile_x + (int)offset.x;
+            int check_y = tile_y + (int)offset.y;
+            if(collisions_layer.isSolid(check_x, check_y)) {
+                func(Rectangle{check_x*tile_size, check_y*tile_size, tile_size, tile_size});
+            }
+        }
+    }
+    
+    // Writes the solid tiles around pos in a caller provided buffer and returns how many were written.
+    // A buffer of MAX_PHYSICS_RECTS_AROUND rects is always big enough.
+    int physics_rects_around(Vector2 pos, Rectangle* out, int capacity) const {
+        int count = 0;
+        for_each_physics_rect_around(pos, [&](Rectangle rect) {
+            if(count < capacity) out[count++] = rect;
+        });
+        return count;
+    }
+    
+    static constexpr int MAX_PHYSICS_RECTS_AROUND = 9;
+    
+    // Calls func(Rectangle) for every solid tile overlapping area, row by row.
+    // The cost is proportional to the number of covered cells, so it works for hitboxes of any size.
+    template<typename Func>
+    void for_each_physics_rect_in(Rectangle area, Func&& func) const {
+        if(tile_size <= 0 || area.width < 0 || area.height < 0) return;
+        int x0 = (int)std::floor(area.x / tile_size);
+        int y0 = (int)std::floor(area.y / tile_size);
+        int x1 = (int)std::ceil((area.x + area.width) / tile_size) - 1;
+        int y1 = (int)std::ceil((area.y + area.height) / tile_size) - 1;
+        collisions_layer.forEachSolidIn(x0, y0, x1, y1, [&](int x, int y) {
+            func(Rectangle{x*tile_size, y*tile_size, tile_size, tile_size});
+        });
+    }
+    
+    // Writes the solid tiles overlapping area in a caller provided buffer and returns how many were found.
+    // The return value can be bigger than capacity, in which case only the first capacity rects were written.
+    int physics_rects_in(Rectangle area, Rectangle* out, int capacity) const {
+        int count = 0;
+        for_each_physics_rect_in(area, [&](Rectangle rect) {
+            if(count < capacity) out[count] = rect;
+            count++;
+        });
+        return count;
+    }
+    
+    // Casts a ray from 'from' to 'to' through the collision tiles and returns the first solid cell it crosses.
+    // Walks the cells in order (Amanatides-Woo DDA), so the cost is the number of cells crossed and not the length / sample step.
+    SineRayHit Raycast(Vector2 from, Vector2 to) const {
+        SineCollisionGrid::Reader reader(collisions_layer);
+        return raycast(from, to, reader);
+    }
+    
+    // Raycasts count rays, from[i] -> to[i], into hits[i].
+    // The rays share the chunk cache of the grid reader, so rays cast from the same area rarely hash twice.
+    void RaycastBatch(const Vector2* from, const Vector2* to, SineRayHit* hits, int count) const {
+        SineCollisionGrid::Reader reader(collisions_layer);
+        for(int i = 0; i < count; i++) {
+            hits[i] = raycast(from[i], to[i], reader);
+        }
+    }
+    
+    // True if no solid tile is between the two points
+    bool HasLineOfSight(Vector2 from, Vector2 to) const {
+        return !Raycast(from, to).hit;
+    }
+    
+    // ===================================================== PATHFINDING ===================================================== //
+    // Finds the shortest path between two positions with A* over the free tiles.
+    // Returns the centers of the tiles to walk through, empty if there is no path.
+    std::vector<Vector2> FindPath(Vector2 from, Vector2 to) {
+        std::vector<Vector2> path;
+        if(tile_size <= 0) return path;
+        std::vector<std::pair<int, int>> cells;
+        pathfinder.findPath(collisions_layer,
+            (int)std::floor(from.x / tile_size), (int)std::floor(from.y / tile_size),
+            (int)std::floor(to.x / tile_size), (int)std::floor(to.y / tile_size), cells);
+        for(auto [x, y] : cells) {
+            path.push_back(Vector2{(x + 0.5f) * tile_size, (y + 0.5f) * tile_size});
+        }
+        return path;
+    }
+    
+    // Normalized direction an agent at pos should move in to reach goal.
+    // All agents with a goal in the same tile share one cached flow field, which is rebuilt only when collisions_layer changes.
+    // Returns {0, 0} if the goal can't be reached from pos.
+    Vector2 GetFlowDirection(Vector2 pos, Vector2 goal) {
+        if(tile_size <= 0) return Vector2{0, 0};
+        const SineFlowField& field = pathfinder.flowField(collisions_layer, (int)std::floor(goal.x / tile_size), (int)std::floor(goal.y / tile_size));
+        int x = (int)std::floor(pos.x / tile_size), y = (int)std::floor(pos.y / tile_size);
+        
+        Vector2 target = goal;
+        if(field.contains(x, y)) {
+            int8_t next = field.next[(size_t)(y - field.originY) * field.width + (x - field.originX)];
+            if(next >= 0) {
+                target = Vector2{(x + SinePathfinder::NEIGHBOURS[next][0] + 0.5f) * tile_size, (y + SinePathfinder::NEIGHBOURS[next][1] + 0.5f) * tile_size};
+            }
+            else if(x != field.goalX || y != field.goalY) {
+                return Vector2{0, 0}; // Unreachable
+            }
+        }
+        
+        Vector2 direction = Vector2{target.x - pos.x, target.y - pos.y};
+        float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+        if(length == 0) return Vector2{0, 0};
+        return Vector2{direction.x / length, direction.y / length};
+    }
+    
+    std::vector<Vector2> tiles_around(Vector2 pos, float tile_size, const SineCollisionGrid& collisions_layer) const {
         std::vector<Vector2> tiles;
+        if(tile_size <= 0) return tiles;
         Vector2 tile_loc = Vector2{std::floor(pos.x / tile_size), std::floor(pos.y / tile_size)};
         for(auto offset : NEIGHBOUR_OFFSETS) {
             Vector2 check_loc = Vector2{tile_loc.x + offset.x, tile_loc.y + offset.y};
-            if(collisions_layer[std::make_pair(check_loc.x, check_loc.y)] == true) {
+            if(collisions_layer.isSolid((int)check_loc.x, (int)check_loc.y)) {
                 tiles.push_back(check_loc);
             }
         }
@@ -326,11 +2558,12 @@ public:
         return tiles;
     }
     
-    std::vector<Rectangle> physics_rects_around(Vector2 pos) {
+    // NOTE: allocates a new vector every call, use for_each_physics_rect_around() in hot code
+    std::vector<Rectangle> physics_rects_around(Vector2 pos) const {
         std::vector<Rectangle> rects;
-        for(auto tile : tiles_around(pos, tile_size, collisions_layer)) {
-            rects.push_back(Rectangle{tile.x*tile_size, tile.y*tile_size, tile_size, tile_size});
-        }
+        for_each_physics_rect_around(pos, [&](Rectangle rect) {
+            rects.push_back(rect);
+        });
         return rects;
     }
     
@@ -350,9 +2583,39 @@ public:
         return VirtualMousePosition;
     }
     
-    ~SineState() {
-        
+    // ===================================================== ENTITY TREE ===================================================== //
+    // Adds an entity to entity_tree, for the Query...() functions. Removing or deleting the entity unregisters it.
+    void RegisterEntity(SineEntity* ent);
+    void UnregisterEntity(SineEntity* ent);
+    // Moves the registered entities in the tree, update() calls it after the members are updated
+    void UpdateEntityTree();
+    
+    // The Query...() functions only report the entities whose category is in mask
+    
+    // Calls func(SineEntity*) for every active registered entity whose hitbox contains point
+    template<typename Func>
+    void QueryPoint(Vector2 point, Func&& func, uint32_t mask = SINE_ALL_CATEGORIES) const;
+    // Calls func(SineEntity*) for every active registered entity whose hitbox overlaps area
+    template<typename Func>
+    void QueryRect(Rectangle area, Func&& func, uint32_t mask = SINE_ALL_CATEGORIES) const;
+    // Calls func(SineEntity*, float t) for every active registered entity the segment from -> to crosses,
+    // t being the fraction of the segment where it enters the hitbox. The order is not sorted.
+    template<typename Func>
+    void QueryRay(Vector2 from, Vector2 to, Func&& func, uint32_t mask = SINE_ALL_CATEGORIES) const;
+    // First active registered entity crossed by the segment from -> to, nullptr if none
+    SineEntity* RaycastEntities(Vector2 from, Vector2 to, float* fraction = nullptr, uint32_t mask = SINE_ALL_CATEGORIES) const;
+    // Calls func(a, b) once for every pair of active registered entities whose hitboxes overlap and that can collide
+    template<typename Func>
+    void QueryOverlapPairs(Func&& func) const;
+    
+    static constexpr uint8_t TYPE = SINE_TYPE_STATE;
+    SINE_TYPE(SineState, SineGroup)
+    
+    SineState() {
+        type_flags |= TYPE;
     }
+    
+    ~SineState();
 };
 
 class SineEntity : public SineBasic
@@ -361,6 +2624,8 @@ private:
     
 public:
     Vector2 position;
+    // Position before the last update, used to interpolate the drawing on a fixed timestep
+    Vector2 last;
     Vector2 velocity;
     Vector2 acceleration;
     // Deceleration of the entity
@@ -370,51 +2635,85 @@ public:
     Rectangle hitbox;
     float rotation = 0;
     bool solid = true;
+    // Sweeps the hitbox against the map tiles and stops it at the first one it would enter.
+    // Use it for fast movers that would otherwise tunnel through thin walls.
+    bool continuous = false;
+    // Never pushed by collide(), only the other entity moves
+    bool immovable = false;
+    // Categories the entity is in, and the ones it collides with (tiles are in the state's tiles_category).
+    // Two entities only overlap if each one's category is in the other's mask.
+    uint32_t category = 1;
+    uint32_t mask = SINE_ALL_CATEGORIES;
+    
+    // Sides touching a solid tile this frame, see isTouching()
+    SineContacts collisions;
     
-    std::unordered_map<std::string, bool> collisions;
+    static constexpr uint8_t TYPE = SINE_TYPE_ENTITY;
+    SINE_TYPE(SineEntity, SineBasic)
     
     SineEntity(float x = 0, float y = 0, float width = 16, float height = 16) {
+        type_flags |= TYPE;
         position = Vector2{x, y};
+        last = position;
         velocity = Vector2{0, 0};
         acceleration = Vector2{0, 0};
         drag = Vector2{0, 0};
         offset = Vector2{0, 0};
         gravity = 0;
         hitbox = Rectangle{x, y, width, height};
-        
-        collisions.insert({{"right", false}, {"left", false}, {"down", false}, {"up", false}});
     }
     
     void update(float dt) override {
-        collisions["right"] = false;
-        collisions["left"] = false;
-        collisions["down"] = false;
-        collisions["up"] = false;
+        collisions.clear();
+        last = position;
         
         applyDrag(dt);
+        Vector2 previous = position;
         
         velocity.x += acceleration.x * dt;
         position.x += velocity.x * dt; // Update position.x based on velocity.x
         
         // ================================================ COLLISION RESOLUTION X ================================================ //
         hitbox.x = position.x + offset.x;
-        if(solid) {
-            for(Rectangle rect : parent_state->physics_rects_around(position)) {
+        // Outside of a state there are no tiles to hit
+        bool hits_tiles = solid && parent_state && (mask & parent_state->tiles_category);
+        if(hits_tiles) {
+            // Every tile the hitbox swept over this frame on the X axis
+            Rectangle swept = hitbox;
+            swept.x = std::fmin(previous.x, position.x) + offset.x;
+            swept.width = hitbox.width + std::fabs(position.x - previous.x);
+            
+            if(continuous && position.x != previous.x) {
+                // First time of impact: the closest tile ahead of the starting hitbox
+                float start = previous.x + offset.x;
+                float contact = hitbox.x;
+                parent_state->for_each_physics_rect_in(swept, [&](Rectangle rect) {
+                    if(position.x > previous.x && rect.x >= start + hitbox.width) contact = std::fmin(contact, rect.x - hitbox.width);
+                    if(position.x < previous.x && rect.x + rect.width <= start) contact = std::fmax(contact, rect.x + rect.width);
+                });
+                if(contact != hitbox.x) {
+                    collisions.set(position.x > previous.x ? SINE_RIGHT : SINE_LEFT);
+                    hitbox.x = contact;
+                    position.x = hitbox.x - offset.x;
+                }
+            }
+            
+            parent_state->for_each_physics_rect_in(swept, [&](Rectangle rect) {
                 if(CheckCollisionRecs(hitbox, rect)) {
                     if(velocity.x > 0) {
                         hitbox.x = rect.x - hitbox.width;
-                        collisions["right"] = true;
+                        collisions.set(SINE_RIGHT);
                     }
                     if(velocity.x < 0) {
                         hitbox.x = rect.x + rect.width;
-                        collisions["left"] = true;
+                        collisions.set(SINE_LEFT);
                     }
                     position.x = hitbox.x - offset.x;
                 }
-            }
+            });
         }
         
-        if(collisions["right"] || collisions["left"]) {
+        if(collisions.has(SINE_RIGHT | SINE_LEFT)) {
             velocity.x = 0;
         }
         // ======================================================================================================================== //
@@ -425,23 +2724,43 @@ public:
         
         // ================================================ COLLISION RESOLUTION Y ================================================ //
         hitbox.y = position.y + offset.y;
-        if(solid) {
-            for(Rectangle rect : parent_state->physics_rects_around(position)) {
+        if(hits_tiles) {
+            // Every tile the hitbox swept over this frame on the Y axis
+            Rectangle swept = hitbox;
+            swept.y = std::fmin(previous.y, position.y) + offset.y;
+            swept.height = hitbox.height + std::fabs(position.y - previous.y);
+            
+            if(continuous && position.y != previous.y) {
+                // First time of impact: the closest tile ahead of the starting hitbox
+                float start = previous.y + offset.y;
+                float contact = hitbox.y;
+                parent_state->for_each_physics_rect_in(swept, [&](Rectangle rect) {
+                    if(position.y > previous.y && rect.y >= start + hitbox.height) contact = std::fmin(contact, rect.y - hitbox.height);
+                    if(position.y < previous.y && rect.y + rect.height <= start) contact = std::fmax(contact, rect.y + rect.height);
+                });
+                if(contact != hitbox.y) {
+                    collisions.set(position.y > previous.y ? SINE_DOWN : SINE_UP);
+                    hitbox.y = contact;
+                    position.y = hitbox.y - offset.y;
+                }
+            }
+            
+            parent_state->for_each_physics_rect_in(swept, [&](Rectangle rect) {
                 if(CheckCollisionRecs(hitbox, rect)) {
                     if(velocity.y > 0) {
                         hitbox.y = rect.y - hitbox.height;
-                        collisions["down"] = true;
+                        collisions.set(SINE_DOWN);
                     }
                     if(velocity.y < 0) {
                         hitbox.y = rect.y + rect.height;
-                        collisions["up"] = true;
+                        collisions.set(SINE_UP);
                     }
                     position.y = hitbox.y - offset.y;
                 }
-            }
+            });
         }
         
-        if(collisions["down"] || collisions["up"]) {
+        if(collisions.has(SINE_DOWN | SINE_UP)) {
             velocity.y = 0;
         }
         // ======================================================================================================================== //
@@ -460,6 +2779,24 @@ public:
         }
     }
     
+    // Position to draw the entity at. On a fixed timestep it is between last and position,
+    // so the movement stays smooth when the game draws more often than it updates.
+    Vector2 getRenderPosition() const {
+        float alpha = parent_state ? parent_state->interpolation_alpha : 1;
+        if(alpha >= 1) return position;
+        return Vector2{last.x + (position.x - last.x) * alpha, last.y + (position.y - last.y) * alpha};
+    }
+    
+    // True if the categories and masks of both entities let them collide
+    bool canCollide(const SineEntity* other) const {
+        return (category & other->mask) && (other->category & mask);
+    }
+    
+    // True if any of the given sides touched a solid tile this frame, e.g. isTouching(SINE_DOWN)
+    bool isTouching(uint8_t sides) const {
+        return collisions.has(sides);
+    }
+    
     // Sets the offset for the hitbox
     void setOffset(float x, float y) {
         offset = Vector2{x, y};
@@ -477,11 +2814,106 @@ public:
         hitbox.width = width; hitbox.height = height;
     }
     
+    // Proxy of the entity in its state's entity_tree, -1 if it isn't registered
+    int tree_proxy = -1;
+    
     ~SineEntity() {
-        
+        if(tree_proxy >= 0 && parent_state) parent_state->UnregisterEntity(this);
     }
 };
 
+inline void SineState::RegisterEntity(SineEntity* ent) {
+    if(ent->tree_proxy >= 0) return;
+    ent->parent_state = this;
+    ent->tree_proxy = entity_tree.createProxy(ent->hitbox, ent, ent->category);
+    tree_entities.push_back(ent);
+}
+
+inline void SineState::UnregisterEntity(SineEntity* ent) {
+    if(ent->tree_proxy < 0) return;
+    entity_tree.destroyProxy(ent->tree_proxy);
+    ent->tree_proxy = -1;
+    auto it = std::find(tree_entities.begin(), tree_entities.end(), ent);
+    if(it != tree_entities.end()) {
+        *it = tree_entities.back();
+        tree_entities.pop_back();
+    }
+}
+
+inline void SineState::UpdateEntityTree() {
+    for(auto* ent : tree_entities) {
+        entity_tree.setCategory(ent->tree_proxy, ent->category);
+        entity_tree.moveProxy(ent->tree_proxy, ent->hitbox, Vector2{ent->position.x - ent->last.x, ent->position.y - ent->last.y});
+    }
+}
+
+template<typename Func>
+inline void SineState::QueryPoint(Vector2 point, Func&& func, uint32_t mask) const {
+    entity_tree.query(Rectangle{point.x, point.y, 0, 0}, [&](int proxy) {
+        SineEntity* ent = entity_tree.getEntity(proxy);
+        if(ent->active && CheckCollisionPointRec(point, ent->hitbox)) func(ent);
+    }, mask);
+}
+
+template<typename Func>
+inline void SineState::QueryRect(Rectangle area, Func&& func, uint32_t mask) const {
+    entity_tree.query(area, [&](int proxy) {
+        SineEntity* ent = entity_tree.getEntity(proxy);
+        if(ent->active && CheckCollisionRecs(area, ent->hitbox)) func(ent);
+    }, mask);
+}
+
+template<typename Func>
+inline void SineState::QueryRay(Vector2 from, Vector2 to, Func&& func, uint32_t mask) const {
+    entity_tree.queryRay(from, to, [&](int proxy, float max_t) {
+        SineEntity* ent = entity_tree.getEntity(proxy);
+        float t = SineAABBTree::segmentEntry(from, to, ent->hitbox, 1);
+        if(ent->active && t >= 0) func(ent, t);
+        return max_t;
+    }, mask);
+}
+
+inline SineEntity* SineState::RaycastEntities(Vector2 from, Vector2 to, float* fraction, uint32_t mask) const {
+    SineEntity* closest = nullptr;
+    float closest_t = 1;
+    entity_tree.queryRay(from, to, [&](int proxy, float max_t) {
+        SineEntity* ent = entity_tree.getEntity(proxy);
+        float t = SineAABBTree::segmentEntry(from, to, ent->hitbox, max_t);
+        if(!ent->active || t < 0) return max_t;
+        closest = ent;
+        closest_t = t;
+        return t; // Nothing further away than this hit matters anymore
+    }, mask);
+    if(fraction) *fraction = closest_t;
+    return closest;
+}
+
+template<typename Func>
+inline void SineState::QueryOverlapPairs(Func&& func) const {
+    entity_tree.forEachProxy([&](int proxy) {
+        SineEntity* a = entity_tree.getEntity(proxy);
+        if(!a->active) return;
+        entity_tree.query(entity_tree.getFatBox(proxy), [&](int other) {
+            if(other <= proxy) return; // Each pair once
+            SineEntity* b = entity_tree.getEntity(other);
+            if(b->active && a->canCollide(b) && CheckCollisionRecs(a->hitbox, b->hitbox)) func(a, b);
+        }, a->mask);
+    });
+}
+
+inline SineState::~SineState() {
+    if(IsWindowReady()) UnloadLDtkChunks(); // Without a window the GL context is gone with the textures
+    
+    // The tree goes away before the members are deleted, don't let them unregister from it
+    for(auto* ent : tree_entities) ent->tree_proxy = -1;
+    
+    // The members made with new (and the groups inside them) go first, while the arena objects they may hold still exist.
+    // Then the objects in the arena are destroyed all at once.
+    deleteMembers();
+    collision_boxes.clear();
+    arena.release();
+}
+
 class SineSprite : public SineEntity
 {
 private:
@@ -492,7 +2924,11 @@ public:
     Color tint;
     bool hasTexture = false;
     
+    static constexpr uint8_t TYPE = SINE_TYPE_SPRITE;
+    SINE_TYPE(SineSprite, SineEntity)
+    
     SineSprite(float x, float y) : SineEntity(x, y) {
+        type_flags |= TYPE;
         scale = Vector2{1, 1};
         tint = WHITE;
     }
@@ -512,7 +2948,8 @@ public:
     void draw() override {
         if(hasTexture) {
             Rectangle source = Rectangle{0, 0, (float)texture.width, (float)texture.height};
-            Rectangle dest = Rectangle{position.x, position.y, (float)texture.width * scale.x, (float)texture.height * scale.y};
+            Vector2 render_position = getRenderPosition();
+            Rectangle dest = Rectangle{render_position.x, render_position.y, (float)texture.width * scale.x, (float)texture.height * scale.y};
             Vector2 origin = Vector2{0, 0};
             
             DrawTexturePro(
@@ -543,17 +2980,38 @@ public:
 };
 
 inline bool overlap(SineEntity* entA, SineEntity* entB) {
-    if(CheckCollisionRecs(entA->hitbox, entB->hitbox)) {
+    if(entA->canCollide(entB) && CheckCollisionRecs(entA->hitbox, entB->hitbox)) {
         return true;
     }
     return false;
 }
 
+inline void SineGroup::buildSpatialHash() {
+    spatial_hash.clear();
+    for(auto* obj : members) {
+        if(SineEntity* e = sine_cast<SineEntity>(obj)) {
+            spatial_hash.insert(obj, e->hitbox, e->category);
+        }
+    }
+    spatial_hash.build();
+}
+
 inline bool overlap(SineEntity* ent, SineGroup* group) {
+    if(group->use_spatial_hash) {
+        if(!ent->active) return false;
+        bool found = false;
+        group->spatial_hash.query(ent->hitbox, [&](SineBasic* obj, Rectangle) {
+            SineEntity* e = static_cast<SineEntity*>(obj);
+            if(!found && obj->active && e->canCollide(ent) && CheckCollisionRecs(ent->hitbox, e->hitbox)) found = true;
+        }, ent->mask);
+        return found;
+    }
+    
     for(auto entity : group->members) {
-        if(entity->active && ent->active) {
-            SineEntity* e = dynamic_cast<SineEntity*>(entity);
-            if(CheckCollisionRecs(ent->hitbox, e->hitbox)) {
+        if(entity && entity->active && ent->active) {
+            // Members that aren't entities (groups, plain SineBasic) have no hitbox to test
+            SineEntity* e = sine_cast<SineEntity>(entity);
+            if(e && ent->canCollide(e) && CheckCollisionRecs(ent->hitbox, e->hitbox)) {
                 return true;
             }
         }
@@ -561,6 +3019,150 @@ inline bool overlap(SineEntity* ent, SineGroup* group) {
     return false;
 }
 
+// Sort and sweep broadphase shared by the group vs group overlap() and collide()
+struct SineSweepItem {
+    float minX, maxX;
+    SineEntity* entity;
+    int side;   // 0 for the first group, 1 for the second
+};
+
+// Adds the active entities of group, and of the groups inside it, to items
+inline void SineGatherSweepItems(SineGroup* group, int side, std::vector<SineSweepItem>& items) {
+    for(auto* obj : group->members) {
+        if(!obj || !obj->active) continue;
+        if(SineEntity* e = sine_cast<SineEntity>(obj)) {
+            items.push_back(SineSweepItem{e->hitbox.x, e->hitbox.x + e->hitbox.width, e, side});
+        }
+        else if(SineGroup* g = sine_cast<SineGroup>(obj)) {
+            SineGatherSweepItems(g, side, items);
+        }
+    }
+}
+
+// Begins (or ends) an iteration of group and of the groups inside it, so func can remove() entities during a sweep.
+// Nested groups end first, the commit of their parent may delete them.
+inline void SineSweepIteration(SineGroup* group, bool begin) {
+    if(begin) group->beginIteration();
+    for(auto* obj : group->members) {
+        if(obj && obj->is(SINE_TYPE_GROUP)) SineSweepIteration(static_cast<SineGroup*>(obj), begin);
+    }
+    if(!begin) group->endIteration();
+}
+
+// Calls func(a, b) once for every overlapping pair, a from groupA and b from groupB.
+// If both are the same group, every pair of its members is tested once.
+// Entities removed by func are deleted once the sweep is over, the ones it kills get no more pairs.
+template<typename Func>
+inline void SineSweepPairs(SineGroup* groupA, SineGroup* groupB, Func&& func) {
+    static thread_local std::vector<SineSweepItem> items;
+    static thread_local std::vector<int> open;
+    items.clear();
+    open.clear();
+    
+    bool same = groupA == groupB;
+    SineSweepIteration(groupA, true);
+    if(!same) SineSweepIteration(groupB, true);
+    SineGatherSweepItems(groupA, 0, items);
+    if(!same) SineGatherSweepItems(groupB, 1, items);
+    std::sort(items.begin(), items.end(), [](const SineSweepItem& a, const SineSweepItem& b) {
+        return a.minX < b.minX;
+    });
+    
+    // Sweep along X: open holds the items whose X span still reaches the current one
+    for(int i = 0; i < (int)items.size(); i++) {
+        const SineSweepItem& item = items[i];
+        int kept = 0;
+        for(int j : open) {
+            if(items[j].maxX <= item.minX) continue; // Closed, it can't reach anything after
+            open[kept++] = j;
+            const SineSweepItem& other = items[j];
+            if(!same && other.side == item.side) continue;
+            if(!item.entity->active || !other.entity->active) continue;
+            if(!item.entity->canCollide(other.entity)) continue;
+            if(!CheckCollisionRecs(item.entity->hitbox, other.entity->hitbox)) continue;
+            if(other.side == 0) func(other.entity, item.entity);
+            else func(item.entity, other.entity);
+        }
+        open.resize(kept);
+        open.push_back(i);
+    }
+    
+    if(!same) SineSweepIteration(groupB, false);
+    SineSweepIteration(groupA, false);
+}
+
+// Calls callback(a, b) for every entity of groupA overlapping one of groupB, each pair once.
+// Returns true if there was any overlap.
+template<typename Func>
+inline bool overlap(SineGroup* groupA, SineGroup* groupB, Func&& callback) {
+    bool found = false;
+    SineSweepPairs(groupA, groupB, [&](SineEntity* a, SineEntity* b) {
+        found = true;
+        callback(a, b);
+    });
+    return found;
+}
+
+inline bool overlap(SineGroup* groupA, SineGroup* groupB) {
+    return overlap(groupA, groupB, [](SineEntity*, SineEntity*) {});
+}
+
+// Pushes two overlapping entities apart along the axis where they overlap the least.
+// Returns false if they don't overlap or can't be separated (not solid or both immovable).
+inline bool separate(SineEntity* a, SineEntity* b) {
+    if(!a->solid || !b->solid || (a->immovable && b->immovable)) return false;
+    Rectangle r = GetCollisionRec(a->hitbox, b->hitbox);
+    if(r.width <= 0 || r.height <= 0) return false;
+    
+    // Share of the push taken by a, all of it if b is immovable
+    float share_a = a->immovable ? 0 : (b->immovable ? 1 : 0.5f);
+    float share_b = 1 - share_a;
+    float a_center_x = a->hitbox.x + a->hitbox.width / 2, b_center_x = b->hitbox.x + b->hitbox.width / 2;
+    float a_center_y = a->hitbox.y + a->hitbox.height / 2, b_center_y = b->hitbox.y + b->hitbox.height / 2;
+    
+    if(r.width < r.height) {
+        float dir = a_center_x < b_center_x ? -1.f : 1.f; // Direction a is pushed in
+        a->hitbox.x += dir * r.width * share_a;
+        b->hitbox.x -= dir * r.width * share_b;
+        a->collisions.set(dir < 0 ? SINE_RIGHT : SINE_LEFT);
+        b->collisions.set(dir < 0 ? SINE_LEFT : SINE_RIGHT);
+        // Stop the speed towards each other, movable pairs keep their average speed
+        float v = a->immovable ? a->velocity.x : (b->immovable ? b->velocity.x : (a->velocity.x + b->velocity.x) / 2);
+        if((a->velocity.x - b->velocity.x) * dir < 0) { a->velocity.x = v; b->velocity.x = v; }
+    }
+    else {
+        float dir = a_center_y < b_center_y ? -1.f : 1.f;
+        a->hitbox.y += dir * r.height * share_a;
+        b->hitbox.y -= dir * r.height * share_b;
+        a->collisions.set(dir < 0 ? SINE_DOWN : SINE_UP);
+        b->collisions.set(dir < 0 ? SINE_UP : SINE_DOWN);
+        float v = a->immovable ? a->velocity.y : (b->immovable ? b->velocity.y : (a->velocity.y + b->velocity.y) / 2);
+        if((a->velocity.y - b->velocity.y) * dir < 0) { a->velocity.y = v; b->velocity.y = v; }
+    }
+    
+    a->position = Vector2{a->hitbox.x - a->offset.x, a->hitbox.y - a->offset.y};
+    b->position = Vector2{b->hitbox.x - b->offset.x, b->hitbox.y - b->offset.y};
+    return true;
+}
+
+// Like overlap(), but also separates the overlapping pairs of solid entities.
+// callback(a, b) is called for every pair that was separated.
+template<typename Func>
+inline bool collide(SineGroup* groupA, SineGroup* groupB, Func&& callback) {
+    bool found = false;
+    SineSweepPairs(groupA, groupB, [&](SineEntity* a, SineEntity* b) {
+        if(separate(a, b)) {
+            found = true;
+            callback(a, b);
+        }
+    });
+    return found;
+}
+
+inline bool collide(SineGroup* groupA, SineGroup* groupB) {
+    return collide(groupA, groupB, [](SineEntity*, SineEntity*) {});
+}
+
 // Stores a unique pointer and a factory function (lambda function)
 struct StoredState {
     std::unique_ptr<SineState> instance;
@@ -572,6 +3174,9 @@ class SineStateManager
 {
 private:
     std::vector<StoredState> states;
+    float fixed_dt = 0;
+    int max_steps = 5;
+    float accumulator = 0;
 public:
     SineStateManager() {}
     int num_of_states = 0;
@@ -580,8 +3185,49 @@ public:
         if(states[0].instance) states[0].instance->start();
     }
     
+    // Runs the current state. With a fixed timestep the frame time is accumulated and the state is updated
+    // in steps of exactly 1/tick_rate, so the simulation doesn't depend on the frame rate.
     void update(float dt) {
-        if(states[0].instance) states[0].instance->update(dt);
+        SineJobSystem::get().flushMainThread(); // raylib calls queued by the jobs
+        if(!states[0].instance) return;
+        states[0].instance->preUpdate(dt);
+        if(fixed_dt <= 0) {
+            states[0].instance->update(dt);
+            return;
+        }
+        
+        accumulator += dt;
+        int steps = 0;
+        while(accumulator >= fixed_dt && steps < max_steps) {
+            states[0].instance->update(fixed_dt);
+            accumulator -= fixed_dt;
+            steps++;
+        }
+        // Too far behind (long hitch or too slow machine): drop the backlog instead of spiralling
+        // keeping only the fraction of a step so the interpolation stays correct
+        if(steps == max_steps && accumulator >= fixed_dt) {
+            accumulator = std::fmod(accumulator, fixed_dt);
+        }
+        states[0].instance->interpolation_alpha = std::min(accumulator / fixed_dt, 1.f);
+    }
+    
+    // Updates the states tick_rate times per second, whatever the frame rate, running at most
+    // max_catch_up_steps updates in one frame. A tick_rate of 0 goes back to one update per frame.
+    //
+    // NOTE: draw sprites with SineEntity::getRenderPosition() to interpolate between the steps
+    // (the camera isn't interpolated, see SineState::CameraFollow()),
+    // and read IsKeyPressed() and the other per-frame input in SineState::preUpdate(), update() can skip frames
+    void SetFixedTimestep(float tick_rate, int max_catch_up_steps = 5) {
+        fixed_dt = tick_rate > 0 ? 1.f / tick_rate : 0;
+        max_steps = std::max(max_catch_up_steps, 1);
+        accumulator = 0;
+        if(!states.empty() && states[0].instance) states[0].instance->interpolation_alpha = 1;
+    }
+    
+    // From 0 to 1, how far between two fixed steps the current frame is
+    float GetInterpolationAlpha() const {
+        if(fixed_dt <= 0) return 1;
+        return std::min(accumulator / fixed_dt, 1.f);
     }
     
     void draw() {
@@ -0,0 +1,338 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <functional>
+#include <unordered_map>
+#include <tuple>
+#include <cstdlib>
+#include <iostream>
+#include "sine_jobs.h"
+
+// Archetype entity-component storage, for scenes with a lot of simple objects where a SineEntity per object
+// (heap allocation, vtable, unused fields) costs too much. Entities with the same set of components share an
+// archetype, whose components are stored column by column in fixed-size chunks, so systems walk packed arrays.
+//
+// The SineBasic classes keep working next to it, SineEcsScene (sine.h) runs a world as a member of a group or state.
+
+// Id of an ECS entity. The generation makes ids of destroyed entities stale, like SineHandle.
+struct SineEcsId {
+    uint32_t index = 0;
+    uint32_t generation = 0;    // 0 is the null id
+
+    bool operator==(const SineEcsId& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const SineEcsId& other) const { return !(*this == other); }
+};
+
+// Up to 64 component types, a signature has one bit per component type
+constexpr int SINE_ECS_MAX_COMPONENTS = 64;
+
+// How to move and destroy a component type without knowing it
+struct SineEcsComponentInfo {
+    size_t size;
+    size_t align;
+    void (*move)(void* dst, void* src);     // Move constructs dst from src
+    void (*destroy)(void* ptr);
+};
+
+// Registry of the component types, filled the first time each type is used
+inline std::vector<SineEcsComponentInfo>& SineEcsComponents() {
+    static std::vector<SineEcsComponentInfo> components;
+    return components;
+}
+
+template<typename T>
+inline int SineEcsComponentId() {
+    static const int id = []() {
+        auto& components = SineEcsComponents();
+        if(components.size() >= SINE_ECS_MAX_COMPONENTS) {
+            std::cerr << "SineEcs: more than " << SINE_ECS_MAX_COMPONENTS << " component types\n";
+            std::abort();
+        }
+        components.push_back(SineEcsComponentInfo{
+            sizeof(T), alignof(T),
+            [](void* dst, void* src) { new(dst) T(std::move(*static_cast<T*>(src))); },
+            [](void* ptr) { static_cast<T*>(ptr)->~T(); }
+        });
+        return (int)components.size() - 1;
+    }();
+    return id;
+}
+
+template<typename... Cs>
+inline uint64_t SineEcsSignature() {
+    static_assert(sizeof...(Cs) > 0, "A signature needs at least one component");
+    return ((uint64_t(1) << SineEcsComponentId<Cs>()) | ...);
+}
+
+// Fixed-size block holding the components of up to capacity entities, one column per component
+struct SineEcsChunk {
+    std::byte* data = nullptr;
+    int count = 0;
+};
+
+// Every entity with exactly the components of signature
+struct SineEcsArchetype {
+    static constexpr size_t CHUNK_BYTES = 16 * 1024;
+
+    uint64_t signature = 0;
+    std::vector<int> components;            // Component ids, in id order
+    int column_of[SINE_ECS_MAX_COMPONENTS]; // Column of a component id, -1 if the archetype doesn't have it
+    std::vector<size_t> offsets;            // Byte offset of each column in a chunk, the ids come first
+    int capacity = 0;                       // Entities per chunk
+    std::vector<SineEcsChunk> chunks;       // All full but the last one
+    int count = 0;
+
+    // Archetypes reached by adding or removing one component, filled as they are used
+    std::unordered_map<int, SineEcsArchetype*> add_edges;
+    std::unordered_map<int, SineEcsArchetype*> remove_edges;
+
+    SineEcsId* ids(const SineEcsChunk& chunk) const {
+        return reinterpret_cast<SineEcsId*>(chunk.data);
+    }
+
+    void* component(const SineEcsChunk& chunk, int column, int row) const {
+        return chunk.data + offsets[column] + row * SineEcsComponents()[components[column]].size;
+    }
+
+    template<typename T>
+    T* column(const SineEcsChunk& chunk) const {
+        return reinterpret_cast<T*>(chunk.data + offsets[column_of[SineEcsComponentId<T>()]]);
+    }
+};
+
+class SineEcsWorld
+{
+private:
+    // Where an entity lives
+    struct Record {
+        SineEcsArchetype* archetype = nullptr;   // nullptr while created but waiting for flush()
+        int chunk = 0;
+        int row = 0;
+        uint32_t generation = 1;
+        bool pending = false;
+    };
+
+    // A change made while iterating, applied by flush() in the order it was made
+    struct PendingOp {
+        virtual void apply(SineEcsWorld& world) = 0;
+        virtual ~PendingOp() = default;
+    };
+
+    template<typename Func>
+    struct PendingFunc : PendingOp {
+        Func func;
+        PendingFunc(Func&& func) : func(std::move(func)) {}
+        void apply(SineEcsWorld& world) override { func(world); }
+    };
+
+    std::vector<std::unique_ptr<SineEcsArchetype>> archetypes;
+    std::unordered_map<uint64_t, SineEcsArchetype*> archetype_of;
+    std::vector<Record> records;
+    std::vector<uint32_t> free_ids;
+    std::vector<std::unique_ptr<PendingOp>> pending;
+    int iterating = 0;
+
+    std::vector<std::function<void(SineEcsWorld&, float)>> systems;
+    std::vector<std::function<void(SineEcsWorld&)>> draw_systems;
+
+    SineEcsArchetype* getArchetype(uint64_t signature);
+    SineEcsArchetype* addEdge(SineEcsArchetype* from, int component);
+    SineEcsArchetype* removeEdge(SineEcsArchetype* from, int component);
+
+    SineEcsId newId();
+    // Queues func(world) for flush()
+    template<typename Func>
+    void defer(Func func) {
+        pending.push_back(std::make_unique<PendingFunc<Func>>(std::move(func)));
+    }
+    // Changes to id wait for flush() while iterating, or while id itself waits for it
+    bool deferred(SineEcsId id) const {
+        return iterating || records[id.index].pending;
+    }
+    // Adds a row at the end of archetype for id, its components are left unconstructed
+    void allocateRow(SineEcsArchetype* archetype, SineEcsId id);
+    // Fills the row of id with the last row of its archetype. destroy_components is false if they were moved out already.
+    void removeRow(SineEcsId id, bool destroy_components);
+    // Moves id to another archetype, moving the components both have and destroying the ones target doesn't have
+    void moveEntity(SineEcsId id, SineEcsArchetype* target);
+
+    template<typename T>
+    void construct(SineEcsId id, T&& value) {
+        const Record& record = records[id.index];
+        SineEcsArchetype* archetype = record.archetype;
+        using C = std::decay_t<T>;
+        new(archetype->component(archetype->chunks[record.chunk], archetype->column_of[SineEcsComponentId<C>()], record.row)) C(std::forward<T>(value));
+    }
+
+    // Calls func(archetype, chunk) for every chunk of the archetypes having all of signature
+    template<typename Func>
+    void forEachChunk(uint64_t signature, Func&& func) {
+        iterating++;
+        for(auto& archetype : archetypes) {
+            if((archetype->signature & signature) != signature) continue;
+            for(auto& chunk : archetype->chunks) {
+                if(chunk.count) func(*archetype, chunk);
+            }
+        }
+        iterating--;
+    }
+
+public:
+    SineEcsWorld() = default;
+    SineEcsWorld(const SineEcsWorld&) = delete;
+    SineEcsWorld& operator=(const SineEcsWorld&) = delete;
+
+    // Creates an entity with the given components.
+    // Inside each() or a system the id is valid right away, but the entity only gets its components (and shows up
+    // in queries) at flush(), the chunks can't grow while they are iterated.
+    template<typename... Cs>
+    SineEcsId create(Cs&&... components) {
+        SineEcsId id = newId();
+        uint64_t signature = 0;
+        if constexpr(sizeof...(Cs) > 0) signature = SineEcsSignature<std::decay_t<Cs>...>();
+        if(iterating) {
+            records[id.index].pending = true;
+            defer([id, signature, values = std::make_tuple(std::decay_t<Cs>(std::forward<Cs>(components))...)](SineEcsWorld& world) mutable {
+                if(!world.alive(id)) return; // Destroyed before the flush
+                world.records[id.index].pending = false;
+                world.allocateRow(world.getArchetype(signature), id);
+                std::apply([&](auto&... value) { (world.construct(id, std::move(value)), ...); }, values);
+            });
+            return id;
+        }
+        allocateRow(getArchetype(signature), id);
+        (construct(id, std::forward<Cs>(components)), ...);
+        return id;
+    }
+
+    // Destroys the entity and its components, the last entity of its archetype takes its row.
+    // Inside each() it waits for the end of the update like destroyLater(), the rows can't move while they are iterated.
+    void destroy(SineEcsId id);
+    // Destroys the entity once the current update is over
+    void destroyLater(SineEcsId id);
+    // Applies the changes made while iterating and the destroyLater() ones, update() calls it after the systems
+    void flush();
+
+    bool alive(SineEcsId id) const {
+        return id.generation && id.index < records.size() && records[id.index].generation == id.generation;
+    }
+
+    int count() const {
+        return (int)(records.size() - free_ids.size());
+    }
+
+    // The component T of id, nullptr if id is dead, waiting for flush() or doesn't have it
+    template<typename T>
+    T* get(SineEcsId id) {
+        if(!alive(id) || records[id.index].pending) return nullptr;
+        const Record& record = records[id.index];
+        int column = record.archetype->column_of[SineEcsComponentId<T>()];
+        if(column < 0) return nullptr;
+        return static_cast<T*>(record.archetype->component(record.archetype->chunks[record.chunk], column, record.row));
+    }
+
+    template<typename T>
+    bool has(SineEcsId id) const {
+        return alive(id) && !records[id.index].pending && records[id.index].archetype->column_of[SineEcsComponentId<T>()] >= 0;
+    }
+
+    // Adds (or overwrites) the component T of id. Adding a component moves the entity to another archetype,
+    // so inside each() or a system it waits for flush() like create().
+    template<typename T>
+    void add(SineEcsId id, T&& value) {
+        using C = std::decay_t<T>;
+        if(!alive(id)) return;
+        if(deferred(id)) {
+            defer([id, value = C(std::forward<T>(value))](SineEcsWorld& world) mutable { world.add(id, std::move(value)); });
+            return;
+        }
+        if(C* existing = get<C>(id)) {
+            *existing = std::forward<T>(value);
+            return;
+        }
+        moveEntity(id, addEdge(records[id.index].archetype, SineEcsComponentId<C>()));
+        construct(id, std::forward<T>(value));
+    }
+
+    // Removes the component T of id, the entity moves to another archetype. Waits for flush() like add().
+    template<typename T>
+    void remove(SineEcsId id) {
+        if(alive(id) && deferred(id)) {
+            defer([id](SineEcsWorld& world) { world.remove<T>(id); });
+            return;
+        }
+        if(!has<T>(id)) return;
+        moveEntity(id, removeEdge(records[id.index].archetype, SineEcsComponentId<T>()));
+    }
+
+    // Calls func(Cs&...) for every entity having all of Cs, or func(SineEcsId, Cs&...) if it takes the id too
+    template<typename... Cs, typename Func>
+    void each(Func&& func) {
+        forEachChunk(SineEcsSignature<Cs...>(), [&](SineEcsArchetype& archetype, SineEcsChunk& chunk) {
+            eachInChunk<Cs...>(archetype, chunk, func);
+        });
+    }
+
+    // Calls func(int count, Cs*...) once per chunk with the packed columns, for loops the compiler can vectorize
+    template<typename... Cs, typename Func>
+    void eachChunk(Func&& func) {
+        forEachChunk(SineEcsSignature<Cs...>(), [&](SineEcsArchetype& archetype, SineEcsChunk& chunk) {
+            func(chunk.count, archetype.column<Cs>(chunk)...);
+        });
+    }
+
+    // Like each(), with the chunks spread over the job system workers. func must only touch the components it is given.
+    template<typename... Cs, typename Func>
+    void eachParallel(Func&& func) {
+        std::vector<std::pair<SineEcsArchetype*, SineEcsChunk*>> items;
+        forEachChunk(SineEcsSignature<Cs...>(), [&](SineEcsArchetype& archetype, SineEcsChunk& chunk) {
+            items.push_back({&archetype, &chunk});
+        });
+        iterating++;
+        SineJobSystem::get().parallel_for(0, (int)items.size(), [&](int begin, int end) {
+            for(int i = begin; i < end; i++) eachInChunk<Cs...>(*items[i].first, *items[i].second, func);
+        }, 1);
+        iterating--;
+    }
+
+    template<typename... Cs, typename Func>
+    static void eachInChunk(SineEcsArchetype& archetype, SineEcsChunk& chunk, Func& func) {
+        SineEcsId* ids = archetype.ids(chunk);
+        auto columns = std::make_tuple(archetype.column<Cs>(chunk)...);
+        for(int i = 0; i < chunk.count; i++) {
+            if constexpr(std::is_invocable_v<Func&, SineEcsId, Cs&...>) {
+                func(ids[i], std::get<Cs*>(columns)[i]...);
+            }
+            else {
+                func(std::get<Cs*>(columns)[i]...);
+            }
+        }
+    }
+
+    // Systems run in the order they were added, func(world, dt) on update() and func(world) on draw()
+    void addSystem(std::function<void(SineEcsWorld&, float)> system) {
+        systems.push_back(std::move(system));
+    }
+
+    void addDrawSystem(std::function<void(SineEcsWorld&)> system) {
+        draw_systems.push_back(std::move(system));
+    }
+
+    void update(float dt) {
+        for(auto& system : systems) system(*this, dt);
+        flush();
+    }
+
+    void draw() {
+        for(auto& system : draw_systems) system(*this);
+    }
+
+    // Destroys every entity, the archetypes and their chunks stay for reuse
+    void clear();
+
+    ~SineEcsWorld();
+};
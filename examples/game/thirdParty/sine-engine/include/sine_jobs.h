@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+// Counts the unfinished jobs of a batch. Wait on it with SineJobSystem::wait(),
+// or use it as the dependency of other jobs with SineJobSystem::runAfter().
+//
+// NOTE: the counter has to outlive its jobs, wait on it before it goes out of scope
+struct SineJobCounter {
+    std::atomic<int> count{0};
+    std::mutex mutex;
+    std::vector<std::function<void()>> continuations; // Jobs waiting for count to reach 0
+
+    bool done() const {
+        return count.load(std::memory_order_acquire) == 0;
+    }
+};
+
+// Work-stealing job system. Every worker thread has its own deque: it pushes and pops its jobs at the back,
+// idle workers steal from the front of the others. Jobs queued from other threads are spread over the workers.
+//
+// The system starts itself the first time it's used, with one worker per core minus the main thread,
+// and stops in CloseSineWindow().
+//
+// NOTE: raylib/GL calls must happen on the main thread, queue them with runOnMainThread()
+class SineJobSystem
+{
+private:
+    struct Worker {
+        std::deque<std::function<void()>> jobs;
+        std::mutex mutex;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<int> queued{0};
+    std::atomic<unsigned> next_worker{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::atomic<bool> started{false};
+    std::thread::id main_thread;
+
+    std::mutex main_mutex;
+    std::vector<std::function<void()>> main_jobs;
+
+    void push(std::function<void()> job);
+    bool tryRunOne();
+    void workerLoop(int index);
+    void finish(SineJobCounter* counter);
+
+public:
+    static SineJobSystem& get();
+
+    // Starts the worker threads, workers < 0 uses one per core minus one for the main thread
+    void start(int workers = -1);
+    // Runs the queued jobs, then joins the worker threads
+    void shutdown();
+
+    int workerCount() const {
+        return (int)workers.size();
+    }
+
+    bool isMainThread() const {
+        return std::this_thread::get_id() == main_thread;
+    }
+
+    // Queues job on a worker. counter, if given, is done once the job has run.
+    void run(std::function<void()> job, SineJobCounter* counter = nullptr);
+    // Queues job once dependency is done. counter, if given, is done once the job has run.
+    void runAfter(SineJobCounter& dependency, std::function<void()> job, SineJobCounter* counter = nullptr);
+    // Blocks until counter is done, running queued jobs instead of sleeping
+    void wait(SineJobCounter& counter);
+
+    // Calls func(begin, end) on sub ranges of [begin, end) spread over the workers, and returns once all of them ran.
+    // grain is the size of a sub range, 0 picks one that gives every worker a few of them.
+    template<typename Func>
+    void parallel_for(int begin, int end, Func&& func, int grain = 0) {
+        int count = end - begin;
+        if(count <= 0) return;
+        if(!started) start();
+        if(grain <= 0) grain = std::max(1, count / (std::max(workerCount(), 1) * 4));
+        if(workerCount() == 0 || count <= grain) {
+            func(begin, end);
+            return;
+        }
+
+        SineJobCounter counter;
+        for(int i = begin + grain; i < end; i += grain) {
+            int sub_end = std::min(i + grain, end);
+            run([&func, i, sub_end]() { func(i, sub_end); }, &counter);
+        }
+        func(begin, std::min(begin + grain, end)); // The calling thread takes the first range
+        wait(counter);
+    }
+
+    // Queues job to run on the main thread, at the next flushMainThread()
+    void runOnMainThread(std::function<void()> job);
+    // Runs the jobs queued for the main thread. SineStateManager::update calls it every frame.
+    void flushMainThread();
+
+    ~SineJobSystem() {
+        shutdown();
+    }
+};
@@ -0,0 +1,80 @@
+// Pooled, recycled and nested members of a state need its parent_state and camera,
+// SineEntity::update() reads the tile collisions through them
+#include "sine.h"
+#include <cstdio>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    if(!(cond)) { \
+        std::printf("FAILED line %d: %s\n", __LINE__, #cond); \
+        failures++; \
+    }
+
+struct Bullet : public SineEntity {
+    SINE_TYPE(Bullet, SineEntity)
+
+    Bullet() : SineEntity(0, 0, 4, 4) {}
+};
+
+static bool inState(SineBasic* obj, SineState& state) {
+    return obj->parent_state == &state && obj->camera == &state.camera;
+}
+
+int main() {
+    SineState state;
+    state.start();
+
+    // Filled before it is added to the state, then recycled from inside it
+    auto* pool = new SineTypedGroup<Bullet>(2);
+    pool->preallocate(2);
+    state.add(pool);
+    Bullet* first = pool->recycle();
+    Bullet* grown = nullptr;
+    for(int i = 0; i < 3; i++) grown = pool->recycle(); // Past the preallocated ones and the first block
+    CHECK(inState(first, state));
+    CHECK(inState(grown, state));
+    state.update(1 / 60.f);
+
+    // Killed and recycled again
+    first->kill();
+    state.update(1 / 60.f);
+    Bullet* again = pool->recycle();
+    CHECK(again == first);
+    CHECK(inState(again, state));
+    state.update(1 / 60.f);
+
+    // Nested groups, filled before and after being added
+    auto* outer = new SineGroup();
+    auto* inner = new SineGroup();
+    auto* before = new SineEntity(0, 0, 4, 4);
+    inner->add(before);
+    outer->add(inner);
+    state.add(outer);
+    auto* after = new SineEntity(0, 0, 4, 4);
+    inner->add(after);
+    CHECK(inState(inner, state));
+    CHECK(inState(before, state));
+    CHECK(inState(after, state));
+
+    // Members of a group updated on the job system
+    auto* workers = new SineTypedGroup<Bullet>(8);
+    workers->parallel = true;
+    state.add(workers);
+    workers->recycle();
+    state.update(1 / 60.f);
+    for(auto* obj : workers->members) CHECK(inState(obj, state));
+
+    // Pooled objects still waiting to be added when the pool goes away are the pool's to free
+    auto* closing = new SineTypedGroup<Bullet>(2);
+    closing->beginIteration();
+    closing->recycle();
+    delete closing;
+
+    // Entities outside of any state skip the tiles instead of crashing
+    SineEntity loose(0, 0, 4, 4);
+    loose.update(1 / 60.f);
+
+    if(failures == 0) std::printf("state_members_test passed\n");
+    return failures == 0 ? 0 : 1;
+}